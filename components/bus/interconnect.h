@@ -21,19 +21,23 @@
 #define _INTERCONNECT_H
 
 #include <vector>
+#include <map>
+#include <deque>
+#include <algorithm>
 
 #include <systemc>
 #include <tlm>
+#include <tlm_utils/peq_with_cb_and_phase.h>
 
 #include <rabbits/component/component.h>
 #include <rabbits/config/manager.h>
 #include <rabbits/logger.h>
 
+#include "hotpath_log.h"
+#include "temporal_decoupling.h"
+
 template <unsigned int BUSWIDTH = 32>
-class Interconnect
-    : public Component
-    , public tlm::tlm_fw_transport_if<>
-    , public tlm::tlm_bw_transport_if<>
+class Interconnect : public Component
 {
 public:
     typedef tlm::tlm_base_target_socket_b<BUSWIDTH,
@@ -51,39 +55,528 @@ protected:
         uint64_t end;
     };
 
+    /* Last mapping hit by an initiator. Bus traffic is very local (polling
+     * loops, sequential accesses), so most decodes end up here. */
+    struct DecodeCache {
+        const TargetMapping *last = nullptr;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    /* Forward interface handed to one bound initiator. It tags incoming
+     * calls with the initiator index. */
+    class InitiatorBinder : public tlm::tlm_fw_transport_if<> {
+    protected:
+        Interconnect &m_interco;
+        int m_id;
+
+    public:
+        InitiatorBinder(Interconnect &interco, int id)
+            : m_interco(interco), m_id(id) {}
+
+        bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
+                                tlm::tlm_dmi& dmi_data)
+        {
+            return m_interco.get_direct_mem_ptr(m_id, trans, dmi_data);
+        }
+
+        tlm::tlm_sync_enum nb_transport_fw(tlm::tlm_generic_payload& trans,
+                                           tlm::tlm_phase& phase,
+                                           sc_core::sc_time& t)
+        {
+            return m_interco.nb_transport_fw(m_id, trans, phase, t);
+        }
+
+        void b_transport(tlm::tlm_generic_payload& trans,
+                         sc_core::sc_time& delay)
+        {
+            m_interco.b_transport(m_id, trans, delay);
+        }
+
+        unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
+        {
+            return m_interco.transport_dbg(m_id, trans);
+        }
+    };
+
+    /* Multi target socket giving a distinct InitiatorBinder to each bound
+     * initiator.
+     *
+     * XXX This relies on get_base_interface() being called exactly once per
+     * initiator binding, in binding order, which is the case with the
+     * Accellera reference implementation. */
+    class TargetSocket
+        : public tlm::tlm_target_socket<BUSWIDTH, tlm::tlm_base_protocol_types, 0>
+    {
+    protected:
+        Interconnect &m_interco;
+        InitiatorBinder m_untagged;
+        std::vector<InitiatorBinder*> m_binders;
+
+    public:
+        TargetSocket(const char *name, Interconnect &interco)
+            : tlm::tlm_target_socket<BUSWIDTH, tlm::tlm_base_protocol_types, 0>(name)
+            , m_interco(interco)
+            , m_untagged(interco, -1)
+        {
+            this->bind(m_untagged);
+        }
+
+        virtual ~TargetSocket()
+        {
+            for (auto b: m_binders) {
+                delete b;
+            }
+        }
+
+        virtual tlm::tlm_fw_transport_if<>& get_base_interface()
+        {
+            int id = m_interco.add_initiator();
+
+            m_binders.push_back(new InitiatorBinder(m_interco, id));
+            return *m_binders.back();
+        }
+    };
+
+    /* Backward interface handed to one bound target. It tags incoming
+     * calls with the target index. */
+    class TargetBinder : public tlm::tlm_bw_transport_if<> {
+    protected:
+        Interconnect &m_interco;
+        int m_id;
+
+    public:
+        TargetBinder(Interconnect &interco, int id)
+            : m_interco(interco), m_id(id) {}
+
+        tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload& trans,
+                                           tlm::tlm_phase& phase,
+                                           sc_core::sc_time& t)
+        {
+            return m_interco.nb_transport_bw(m_id, trans, phase, t);
+        }
+
+        void invalidate_direct_mem_ptr(sc_dt::uint64 start_range,
+                                       sc_dt::uint64 end_range)
+        {
+            m_interco.invalidate_direct_mem_ptr(m_id, start_range, end_range);
+        }
+    };
+
+    /* Multi initiator socket giving a distinct TargetBinder to each bound
+     * target. Same caveat as TargetSocket: binder indexes match the
+     * m_initiator indexes only with the Accellera reference implementation. */
+    class InitiatorSocket
+        : public tlm::tlm_initiator_socket<BUSWIDTH, tlm::tlm_base_protocol_types, 0>
+    {
+    protected:
+        Interconnect &m_interco;
+        TargetBinder m_untagged;
+        std::vector<TargetBinder*> m_binders;
+
+    public:
+        InitiatorSocket(const char *name, Interconnect &interco)
+            : tlm::tlm_initiator_socket<BUSWIDTH, tlm::tlm_base_protocol_types, 0>(name)
+            , m_interco(interco)
+            , m_untagged(interco, -1)
+        {
+            this->bind(m_untagged);
+        }
+
+        virtual ~InitiatorSocket()
+        {
+            for (auto b: m_binders) {
+                delete b;
+            }
+        }
+
+        virtual tlm::tlm_bw_transport_if<>& get_base_interface()
+        {
+            m_binders.push_back(new TargetBinder(m_interco, m_binders.size()));
+            return *m_binders.back();
+        }
+    };
+
+    /* Sorted by begin address, non-overlapping. Kept sorted as targets get
+     * connected so that decoding is a binary search. */
     std::vector<TargetMapping> m_ranges;
 
-    tlm::tlm_target_socket<BUSWIDTH, tlm::tlm_base_protocol_types, 0> m_target;
-    tlm::tlm_initiator_socket<BUSWIDTH, tlm::tlm_base_protocol_types, 0> m_initiator;
+    /* One entry per bound initiator */
+    std::vector<DecodeCache> m_decode_caches;
+
+    /* Non-blocking transactions in flight */
+    struct Route {
+        int initiator;
+        int target;
+        sc_dt::uint64 offset;
+        bool target_done;
+    };
+
+    std::map<tlm::tlm_generic_payload*, Route> m_routes;
+
+    /* Base protocol exclusion rules: a target has at most one BEGIN_REQ
+     * waiting for its END_REQ, an initiator at most one BEGIN_RESP waiting
+     * for its END_RESP. Other transactions wait in FIFO order. */
+    struct TargetState {
+        tlm::tlm_generic_payload *req_pending = nullptr;
+        std::deque<tlm::tlm_generic_payload*> requests;
+    };
+
+    struct InitiatorState {
+        tlm::tlm_generic_payload *resp_pending = nullptr;
+        std::deque<tlm::tlm_generic_payload*> responses;
+    };
+
+    /* Indexed as m_initiator (targets) and m_target (initiators) */
+    std::vector<TargetState> m_target_states;
+    std::vector<InitiatorState> m_initiator_states;
+
+    TargetSocket m_target;
+    InitiatorSocket m_initiator;
+
+    sc_core::sc_time m_request_latency;
+    sc_core::sc_time m_response_latency;
+    bool m_temporal_decoupling;
+
+    tlm_utils::peq_with_cb_and_phase<Interconnect> m_request_peq;
+    tlm_utils::peq_with_cb_and_phase<Interconnect> m_response_peq;
+
+    /* Targets and initiators that got free with transactions waiting for
+     * them. They are served in the next delta cycle by arbitrate_method(),
+     * out of the nb_transport call that freed them. */
+    std::vector<int> m_free_targets;
+    std::vector<int> m_free_initiators;
+    sc_core::sc_event m_arbitrate_ev;
+
+    int add_initiator()
+    {
+        m_decode_caches.push_back(DecodeCache());
+        m_initiator_states.push_back(InitiatorState());
+        return m_decode_caches.size() - 1;
+    }
+
+    void report_unmapped(tlm::tlm_generic_payload &trans)
+    {
+        Parameters & globals = m_config.get_global_params();
+        if (globals["report-non-mapped-access"].as<bool>()) {
+            MLOG_F(SIM, ERR, "Cannot find target at address 0x%" PRIx64 "\n",
+                   static_cast<uint64_t>(trans.get_address()));
+        }
+        trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+    }
+
+    void end_route(typename std::map<tlm::tlm_generic_payload*, Route>::iterator it)
+    {
+        tlm::tlm_generic_payload *trans = it->first;
+
+        m_routes.erase(it);
+
+        if (trans->has_mm()) {
+            trans->release();
+        }
+    }
+
+    Route & find_route(tlm::tlm_generic_payload &trans)
+    {
+        auto it = m_routes.find(&trans);
+
+        if (it == m_routes.end()) {
+            MLOG_F(SIM, ERR, "Unknown non-blocking transaction\n");
+            abort();
+        }
+
+        return it->second;
+    }
+
+    /* Called when the request went through the bus request latency */
+    void request_peq_cb(tlm::tlm_generic_payload &trans, const tlm::tlm_phase &ph)
+    {
+        int target = find_route(trans).target;
+
+        m_target_states[target].requests.push_back(&trans);
+        arbitrate_requests(target);
+    }
+
+    /* Called when the response went through the bus response latency */
+    void response_peq_cb(tlm::tlm_generic_payload &trans, const tlm::tlm_phase &ph)
+    {
+        int initiator = find_route(trans).initiator;
+
+        m_initiator_states[initiator].responses.push_back(&trans);
+        arbitrate_responses(initiator);
+    }
+
+    void arbitrate_method()
+    {
+        std::vector<int> targets, initiators;
+
+        /* Arbitration can free other targets and initiators */
+        targets.swap(m_free_targets);
+        initiators.swap(m_free_initiators);
+
+        for (int t: targets) {
+            arbitrate_requests(t);
+        }
+
+        for (int i: initiators) {
+            arbitrate_responses(i);
+        }
+    }
+
+    /* Send the next waiting request to a target, if it is free */
+    void arbitrate_requests(int target)
+    {
+        TargetState &ts = m_target_states[target];
+
+        if (ts.req_pending != nullptr || ts.requests.empty()) {
+            return;
+        }
+
+        tlm::tlm_generic_payload &trans = *ts.requests.front();
+        tlm::tlm_phase phase = tlm::BEGIN_REQ;
+        sc_core::sc_time t = sc_core::SC_ZERO_TIME;
+
+        ts.requests.pop_front();
+        ts.req_pending = &trans;
 
-    int decode_address(sc_dt::uint64 addr,
+        tlm::tlm_sync_enum status = m_initiator[target]->nb_transport_fw(trans, phase, t);
+
+        switch (status) {
+        case tlm::TLM_ACCEPTED:
+            /* The target will come back through nb_transport_bw */
+            break;
+
+        case tlm::TLM_UPDATED:
+            end_request(trans, phase, t);
+            break;
+
+        case tlm::TLM_COMPLETED:
+            /* Early completion. The initiator still expects a BEGIN_RESP. */
+            find_route(trans).target_done = true;
+            phase = tlm::BEGIN_RESP;
+            end_request(trans, phase, t);
+            break;
+        }
+    }
+
+    /* The target accepted the pending request, with END_REQ or with an
+     * implicit one in BEGIN_RESP */
+    void end_request(tlm::tlm_generic_payload &trans, tlm::tlm_phase &phase,
+                     sc_core::sc_time &t)
+    {
+        Route &r = find_route(trans);
+        TargetState &ts = m_target_states[r.target];
+
+        ts.req_pending = nullptr;
+
+        if (!ts.requests.empty()) {
+            m_free_targets.push_back(r.target);
+            m_arbitrate_ev.notify(sc_core::SC_ZERO_TIME);
+        }
+
+        if (phase == tlm::BEGIN_RESP) {
+            m_response_peq.notify(trans, phase, t + m_response_latency);
+        } else {
+            m_target[r.initiator]->nb_transport_bw(trans, phase, t);
+        }
+    }
+
+    /* Send the next waiting response to an initiator, if it is free */
+    void arbitrate_responses(int initiator)
+    {
+        InitiatorState &is = m_initiator_states[initiator];
+
+        if (is.resp_pending != nullptr || is.responses.empty()) {
+            return;
+        }
+
+        tlm::tlm_generic_payload &trans = *is.responses.front();
+        tlm::tlm_phase phase = tlm::BEGIN_RESP;
+        sc_core::sc_time t = sc_core::SC_ZERO_TIME;
+
+        is.responses.pop_front();
+        is.resp_pending = &trans;
+
+        trans.set_address(trans.get_address() + find_route(trans).offset);
+
+        tlm::tlm_sync_enum status = m_target[initiator]->nb_transport_bw(trans, phase, t);
+
+        if (status == tlm::TLM_COMPLETED
+            || (status == tlm::TLM_UPDATED && phase == tlm::END_RESP)) {
+            end_response(trans, t);
+        }
+    }
+
+    /* The initiator accepted the pending response. The target gets its
+     * END_RESP, unless it completed the transaction early. */
+    tlm::tlm_sync_enum end_response(tlm::tlm_generic_payload &trans, sc_core::sc_time &t)
+    {
+        auto it = m_routes.find(&trans);
+        Route &r = it->second;
+        InitiatorState &is = m_initiator_states[r.initiator];
+        tlm::tlm_sync_enum status = tlm::TLM_COMPLETED;
+
+        is.resp_pending = nullptr;
+
+        if (!is.responses.empty()) {
+            m_free_initiators.push_back(r.initiator);
+            m_arbitrate_ev.notify(sc_core::SC_ZERO_TIME);
+        }
+
+        if (!r.target_done) {
+            tlm::tlm_phase phase = tlm::END_RESP;
+            status = m_initiator[r.target]->nb_transport_fw(trans, phase, t);
+        }
+
+        end_route(it);
+        return status;
+    }
+
+    const TargetMapping * find_mapping(sc_dt::uint64 addr) const
+    {
+        auto it = std::upper_bound(m_ranges.begin(), m_ranges.end(), addr,
+                                   [] (sc_dt::uint64 a, const TargetMapping &r) {
+                                       return a < r.begin;
+                                   });
+
+        if (it == m_ranges.begin()) {
+            return nullptr;
+        }
+
+        --it;
+
+        if (addr >= it->end) {
+            return nullptr;
+        }
+
+        return &*it;
+    }
+
+    int decode_address(int initiator, sc_dt::uint64 addr,
                        sc_dt::uint64& addr_offset)
     {
-        for (auto &range: m_ranges) {
-            if (addr >= range.begin && addr < range.end) {
-                addr_offset = range.begin;
-                return range.target_index;
+        const TargetMapping *m;
+
+        if (initiator < 0) {
+            m = find_mapping(addr);
+        } else {
+            DecodeCache &cache = m_decode_caches[initiator];
+
+            if (cache.last && addr >= cache.last->begin && addr < cache.last->end) {
+                cache.hits++;
+                m = cache.last;
+            } else {
+                cache.misses++;
+                m = find_mapping(addr);
+
+                if (m != nullptr) {
+                    cache.last = m;
+                }
             }
         }
 
-        return -1;
+        if (m == nullptr) {
+            return -1;
+        }
+
+        addr_offset = m->begin;
+        return m->target_index;
+    }
+
+    void insert_range(const TargetMapping &range)
+    {
+        if (range.begin == range.end) {
+            /* Nothing can be decoded to it, and it would break the sorted
+             * non-overlapping invariant find_mapping() relies on */
+            MLOG_F(APP, WRN, "Ignoring empty target mapping at 0x%016" PRIx64 "\n",
+                   range.begin);
+            return;
+        }
+
+        auto it = std::upper_bound(m_ranges.begin(), m_ranges.end(), range.begin,
+                                   [] (uint64_t a, const TargetMapping &r) {
+                                       return a < r.begin;
+                                   });
+
+        bool overlap = (it != m_ranges.end() && it->begin < range.end)
+            || (it != m_ranges.begin() && (it - 1)->end > range.begin);
+
+        if (overlap) {
+            MLOG_F(APP, ERR, "Target mapping [0x%016" PRIx64 ", 0x%016" PRIx64 ") "
+                   "overlaps an existing mapping\n", range.begin, range.end);
+            abort();
+        }
+
+        m_ranges.insert(it, range);
+
+        /* Cached entries point into m_ranges */
+        for (auto &cache: m_decode_caches) {
+            cache.last = nullptr;
+        }
     }
 
 public:
     SC_HAS_PROCESS(Interconnect);
     Interconnect(sc_core::sc_module_name name, const Parameters &p, ConfigManager &c)
         : Component(name, p, c)
-        , m_target("bus_target_socket")
-        , m_initiator("bus_initiator_socket")
+        , m_target("bus_target_socket", *this)
+        , m_initiator("bus_initiator_socket", *this)
+        , m_request_peq(this, &Interconnect::request_peq_cb)
+        , m_response_peq(this, &Interconnect::response_peq_cb)
     {
-        m_target.bind(*this);
-        m_initiator.bind(*this);
+        m_request_latency = p["request-latency"].as<sc_core::sc_time>();
+        m_response_latency = p["response-latency"].as<sc_core::sc_time>();
+        m_temporal_decoupling = p["temporal-decoupling"].as<bool>();
+
+        SC_METHOD(arbitrate_method);
+        sensitive << m_arbitrate_ev;
+        dont_initialize();
+
+        if (m_temporal_decoupling) {
+            sc_core::sc_time quantum = p["global-quantum"].as<sc_core::sc_time>();
+            bool conflict;
+
+            if (!setup_global_quantum(quantum, conflict)) {
+                MLOG(APP, WRN) << "Temporal decoupling enabled with a zero global quantum, "
+                    "the bus will synchronize on every access\n";
+            } else if (conflict) {
+                MLOG(APP, WRN) << "Global quantum already set to "
+                    << tlm::tlm_global_quantum::instance().get()
+                    << " by another component, ignoring " << quantum << "\n";
+            }
+        }
     }
 
     virtual ~Interconnect()
     {
     }
 
+    void end_of_simulation()
+    {
+        for (unsigned int i = 0; i < m_decode_caches.size(); i++) {
+            const DecodeCache &cache = m_decode_caches[i];
+
+            if (cache.hits + cache.misses == 0) {
+                continue;
+            }
+
+            MLOG(SIM, INF) << "initiator " << i << " decode cache: "
+                << cache.hits << " hits, " << cache.misses << " misses\n";
+        }
+    }
+
+
+    /* Decode cache statistics of a bound initiator */
+    uint64_t get_decode_hits(int initiator) const
+    {
+        return m_decode_caches[initiator].hits;
+    }
+
+    uint64_t get_decode_misses(int initiator) const
+    {
+        return m_decode_caches[initiator].misses;
+    }
+
 
     void connect_initiator(BaseInitiatorSocket &initiator)
     {
@@ -103,78 +596,121 @@ public:
 
         range.begin = addr;
         range.end = addr + len;
-        m_ranges.push_back(range);
+        insert_range(range);
+
+        m_target_states.push_back(TargetState());
 
         m_initiator.bind(target);
     }
 
 
-    /* tlm::tlm_fw_transport_if */
-    virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
-                                    tlm::tlm_dmi& dmi_data)
+    /* Forward path, tagged with the initiator index */
+    bool get_direct_mem_ptr(int initiator, tlm::tlm_generic_payload& trans,
+                            tlm::tlm_dmi& dmi_data)
     {
         bool ret;
-        sc_dt::uint64 offset;
-
-        int target_index = decode_address(trans.get_address(), offset);
+        const TargetMapping *m = find_mapping(trans.get_address());
 
-        if (target_index == -1) {
+        if (m == nullptr) {
             return false;
         }
 
-        trans.set_address(trans.get_address() - offset);
+        trans.set_address(trans.get_address() - m->begin);
 
-        ret = m_initiator[target_index]->get_direct_mem_ptr(trans, dmi_data);
+        ret = m_initiator[m->target_index]->get_direct_mem_ptr(trans, dmi_data);
 
-        if (ret) {
-            dmi_data.set_start_address(dmi_data.get_start_address() + offset);
-            dmi_data.set_end_address(dmi_data.get_end_address() + offset);
-        }
+        /* Granted or denied, the range is in target-local addresses.
+         * Translate it into the bus address space, clipped to the mapping. */
+        sc_dt::uint64 last = m->end - m->begin - 1;
+        sc_dt::uint64 start = std::min(dmi_data.get_start_address(), last);
+        sc_dt::uint64 end = std::min(dmi_data.get_end_address(), last);
+
+        dmi_data.set_start_address(m->begin + start);
+        dmi_data.set_end_address(m->begin + std::max(start, end));
 
         return ret;
     }
 
-    virtual tlm::tlm_sync_enum nb_transport_fw(tlm::tlm_generic_payload& trans,
-                                               tlm::tlm_phase& phase,
-                                               sc_core::sc_time& t)
+    tlm::tlm_sync_enum nb_transport_fw(int initiator,
+                                       tlm::tlm_generic_payload& trans,
+                                       tlm::tlm_phase& phase,
+                                       sc_core::sc_time& t)
     {
-        MLOG_F(SIM, ERR, "Non-blocking transport not implemented\n");
+        if (initiator < 0) {
+            /* No backward path to answer on */
+            MLOG_F(SIM, ERR, "Non-blocking transaction from an unknown initiator\n");
+            trans.set_response_status(tlm::TLM_GENERIC_ERROR_RESPONSE);
+            return tlm::TLM_COMPLETED;
+        }
+
+        if (phase == tlm::BEGIN_REQ) {
+            Route r;
+
+            int target_index = decode_address(initiator, trans.get_address(), r.offset);
+            if (target_index == -1) {
+                report_unmapped(trans);
+                t += m_request_latency;
+                return tlm::TLM_COMPLETED;
+            }
+
+            r.initiator = initiator;
+            r.target = target_index;
+            r.target_done = false;
+            m_routes[&trans] = r;
+
+            if (trans.has_mm()) {
+                trans.acquire();
+            }
+
+            trans.set_address(trans.get_address() - r.offset);
+            m_request_peq.notify(trans, phase, t + m_request_latency);
+
+            return tlm::TLM_ACCEPTED;
+        }
+
+        if (phase == tlm::END_RESP) {
+            if (m_initiator_states[initiator].resp_pending != &trans) {
+                MLOG_F(SIM, ERR, "END_RESP for an unknown transaction\n");
+                abort();
+            }
+
+            return end_response(trans, t);
+        }
+
+        MLOG_F(SIM, ERR, "Unexpected phase on the forward path\n");
         abort();
         return tlm::TLM_COMPLETED;
     }
 
-    virtual void b_transport(tlm::tlm_generic_payload& trans,
-                             sc_core::sc_time& delay)
+    void b_transport(int initiator, tlm::tlm_generic_payload& trans,
+                     sc_core::sc_time& delay)
     {
         sc_dt::uint64 offset;
 
-        wait(3, sc_core::SC_NS);
+        /* Untimed platforms set both latencies to zero and never switch
+         * context in the interconnect */
+        apply_latency(m_temporal_decoupling, m_request_latency, delay);
 
-        int target_index = decode_address(trans.get_address(), offset);
+        int target_index = decode_address(initiator, trans.get_address(), offset);
         if (target_index == -1) {
-            Parameters & globals = m_config.get_global_params();
-            if (globals["report-non-mapped-access"].as<bool>()) {
-                MLOG_F(SIM, ERR, "Cannot find target at address 0x%" PRIx64 "\n",
-                       static_cast<uint64_t>(trans.get_address()));
-            }
-            trans.set_response_status(tlm::TLM_ADDRESS_ERROR_RESPONSE);
+            report_unmapped(trans);
             return;
         }
 
-	MLOG_F(SIM, TRC, "Memory request at address 0x%08" PRIx64 "\n", trans.get_address());
+        HOTPATH_MLOG_F(SIM, TRC, "Memory request at address 0x%08" PRIx64 "\n", trans.get_address());
 
         trans.set_address(trans.get_address() - offset);
 
         m_initiator[target_index]->b_transport(trans, delay);
 
-        wait(1, sc_core::SC_NS);
+        apply_latency(m_temporal_decoupling, m_response_latency, delay);
     }
 
-    virtual unsigned int transport_dbg(tlm::tlm_generic_payload& trans)
+    unsigned int transport_dbg(int initiator, tlm::tlm_generic_payload& trans)
     {
         sc_dt::uint64 offset;
 
-        int target_index = decode_address(trans.get_address(), offset);
+        int target_index = decode_address(-1, trans.get_address(), offset);
         if(target_index == -1) {
             return 0;
         }
@@ -184,24 +720,67 @@ public:
     }
 
 
-    /* tlm::tlm_bw_transport_if */
-    virtual tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload& trans,
-                                               tlm::tlm_phase& phase,
-                                               sc_core::sc_time& t)
+    /* Backward path, tagged with the target index */
+    tlm::tlm_sync_enum nb_transport_bw(int target,
+                                       tlm::tlm_generic_payload& trans,
+                                       tlm::tlm_phase& phase,
+                                       sc_core::sc_time& t)
     {
-        MLOG_F(SIM, ERR, "Non-blocking transport not implemented\n");
-        abort();
-        return tlm::TLM_COMPLETED;
+        TargetState &ts = m_target_states[target];
+
+        switch (phase) {
+        case tlm::END_REQ:
+        case tlm::BEGIN_RESP:
+            if (ts.req_pending == &trans) {
+                end_request(trans, phase, t);
+            } else if (phase == tlm::BEGIN_RESP) {
+                /* END_REQ already seen */
+                m_response_peq.notify(trans, phase, t + m_response_latency);
+            } else {
+                MLOG_F(SIM, ERR, "END_REQ for an unknown transaction\n");
+                abort();
+            }
+
+            /* END_RESP is sent once the initiator accepted the response */
+            return tlm::TLM_ACCEPTED;
+
+        default:
+            MLOG_F(SIM, ERR, "Unexpected phase on the backward path\n");
+            abort();
+            return tlm::TLM_COMPLETED;
+        }
     }
 
-    virtual void invalidate_direct_mem_ptr(sc_dt::uint64 start_range,
-                                           sc_dt::uint64 end_range)
+    void invalidate_direct_mem_ptr(int target,
+                                   sc_dt::uint64 start_range,
+                                   sc_dt::uint64 end_range)
     {
-        MLOG_F(SIM, ERR, "DMI memory invalidation not implemented\n");
-        abort();
-    }
+        for (auto &range: m_ranges) {
+            sc_dt::uint64 start, end;
+
+            if (target >= 0 && range.target_index != target) {
+                continue;
+            }
+
+            /* Translate the target-local range into the bus address space,
+             * clipped to the mapping */
+            if (start_range > range.end - range.begin - 1) {
+                continue;
+            }
+
+            start = range.begin + start_range;
 
+            if (end_range > range.end - range.begin - 1) {
+                end = range.end - 1;
+            } else {
+                end = range.begin + end_range;
+            }
 
+            for (int i = 0; i < m_target.size(); i++) {
+                m_target[i]->invalidate_direct_mem_ptr(start, end);
+            }
+        }
+    }
 };
 
 #endif
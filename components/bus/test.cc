@@ -0,0 +1,785 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define RABBITS_TEST_MOD interconnect
+
+#include <rabbits/test/test.h>
+
+#include <deque>
+#include <algorithm>
+
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <tlm_utils/simple_initiator_socket.h>
+#include <tlm_utils/simple_target_socket.h>
+#include <tlm_utils/peq_with_cb_and_phase.h>
+
+#include "interconnect.h"
+
+using namespace sc_core;
+
+const sc_time REQUEST_LATENCY(3, SC_NS);
+const sc_time RESPONSE_LATENCY(1, SC_NS);
+
+/* Target side timings, from BEGIN_REQ to END_REQ and from END_REQ to
+ * BEGIN_RESP */
+const sc_time TARGET_ACCEPT_TIME(10, SC_NS);
+const sc_time TARGET_RESPONSE_TIME(20, SC_NS);
+
+/* Initiator side, from BEGIN_RESP to END_RESP when deferred */
+const sc_time INITIATOR_ACCEPT_TIME(50, SC_NS);
+
+const sc_time TIMEOUT(1, SC_US);
+
+const uint64_t TARGET0_BASE = 0x1000;
+const uint64_t TARGET1_BASE = 0x2000;
+const uint64_t TARGET_SIZE = 0x100;
+
+/*
+ * Minimal AT target, recording base protocol violations. Depending on its
+ * mode, a BEGIN_REQ is answered:
+ *   - ACCEPT: with END_REQ then BEGIN_RESP on the backward path,
+ *   - UPDATED: right away with TLM_UPDATED and BEGIN_RESP,
+ *   - COMPLETED: right away with TLM_COMPLETED.
+ */
+class AtTarget : public sc_module {
+public:
+    enum Mode { ACCEPT, UPDATED, COMPLETED };
+
+    tlm_utils::simple_target_socket<AtTarget> socket;
+
+    Mode mode;
+    int requests;      /* BEGIN_REQ not yet accepted */
+    int max_requests;
+    int end_resps;
+    bool violation;
+    uint64_t last_address;
+
+    /* DMI answer, in target-local addresses */
+    bool dmi_allowed;
+    uint64_t dmi_start;
+    uint64_t dmi_end;
+
+protected:
+    tlm_utils::peq_with_cb_and_phase<AtTarget> m_peq;
+    tlm::tlm_generic_payload *m_resp_pending;
+    std::deque<tlm::tlm_generic_payload*> m_responses;
+
+    void execute(tlm::tlm_generic_payload &trans)
+    {
+        last_address = trans.get_address();
+        trans.set_response_status(tlm::TLM_OK_RESPONSE);
+    }
+
+    /* Loosely timed accesses complete right away */
+    void b_transport(tlm::tlm_generic_payload &trans, sc_time &delay)
+    {
+        execute(trans);
+    }
+
+    tlm::tlm_sync_enum nb_transport_fw(tlm::tlm_generic_payload &trans,
+                                       tlm::tlm_phase &phase, sc_time &t)
+    {
+        if (phase == tlm::END_RESP) {
+            if (&trans != m_resp_pending) {
+                violation = true;
+            }
+
+            end_response();
+            return tlm::TLM_COMPLETED;
+        }
+
+        if (phase != tlm::BEGIN_REQ || requests) {
+            violation = true;
+        }
+
+        switch (mode) {
+        case UPDATED:
+            if (m_resp_pending != nullptr) {
+                /* Would break the response exclusion rule, the previous
+                 * response never got its END_RESP */
+                violation = true;
+                return tlm::TLM_ACCEPTED;
+            }
+
+            execute(trans);
+            m_resp_pending = &trans;
+            phase = tlm::BEGIN_RESP;
+            return tlm::TLM_UPDATED;
+
+        case COMPLETED:
+            execute(trans);
+            return tlm::TLM_COMPLETED;
+
+        case ACCEPT:
+        default:
+            requests++;
+            max_requests = std::max(max_requests, requests);
+            m_peq.notify(trans, tlm::END_REQ, t + TARGET_ACCEPT_TIME);
+            return tlm::TLM_ACCEPTED;
+        }
+    }
+
+    bool get_direct_mem_ptr(tlm::tlm_generic_payload &trans, tlm::tlm_dmi &dmi)
+    {
+        last_address = trans.get_address();
+        dmi.set_start_address(dmi_start);
+        dmi.set_end_address(dmi_end);
+        return dmi_allowed;
+    }
+
+    void peq_cb(tlm::tlm_generic_payload &trans, const tlm::tlm_phase &ph)
+    {
+        if (ph == tlm::END_REQ) {
+            tlm::tlm_phase phase = tlm::END_REQ;
+            sc_time t = SC_ZERO_TIME;
+
+            requests--;
+            socket->nb_transport_bw(trans, phase, t);
+            m_peq.notify(trans, tlm::BEGIN_RESP, TARGET_RESPONSE_TIME);
+            return;
+        }
+
+        /* BEGIN_RESP is a new response, END_RESP a retry */
+        if (ph == tlm::BEGIN_RESP) {
+            execute(trans);
+            m_responses.push_back(&trans);
+        }
+
+        if (m_resp_pending != nullptr || m_responses.empty()) {
+            return;
+        }
+
+        tlm::tlm_generic_payload &resp = *m_responses.front();
+        tlm::tlm_phase phase = tlm::BEGIN_RESP;
+        sc_time t = SC_ZERO_TIME;
+
+        m_responses.pop_front();
+        m_resp_pending = &resp;
+
+        if (socket->nb_transport_bw(resp, phase, t) == tlm::TLM_COMPLETED) {
+            end_response();
+        }
+    }
+
+    void end_response()
+    {
+        m_resp_pending = nullptr;
+        end_resps++;
+
+        if (!m_responses.empty()) {
+            m_peq.notify(*m_responses.front(), tlm::END_RESP, SC_ZERO_TIME);
+        }
+    }
+
+public:
+    AtTarget(sc_module_name n)
+        : sc_module(n)
+        , socket("socket")
+        , mode(ACCEPT)
+        , requests(0)
+        , max_requests(0)
+        , end_resps(0)
+        , violation(false)
+        , last_address(0)
+        , dmi_allowed(false)
+        , dmi_start(0)
+        , dmi_end(~0ull)
+        , m_peq(this, &AtTarget::peq_cb)
+        , m_resp_pending(nullptr)
+    {
+        socket.register_nb_transport_fw(this, &AtTarget::nb_transport_fw);
+        socket.register_b_transport(this, &AtTarget::b_transport);
+        socket.register_get_direct_mem_ptr(this, &AtTarget::get_direct_mem_ptr);
+    }
+};
+
+/* Minimal AT initiator. Responses are completed on the backward call, or
+ * accepted and completed INITIATOR_ACCEPT_TIME later with defer_end_resp. */
+class AtInitiator : public sc_module {
+public:
+    tlm_utils::simple_initiator_socket<AtInitiator> socket;
+
+    bool defer_end_resp;
+    int responses;     /* BEGIN_RESP not yet completed */
+    int max_responses;
+    bool violation;
+
+    uint64_t inval_start;
+    uint64_t inval_end;
+
+protected:
+    tlm_utils::peq_with_cb_and_phase<AtInitiator> m_peq;
+    tlm::tlm_generic_payload *m_req_pending;
+    sc_event m_ev;
+
+    tlm::tlm_sync_enum nb_transport_bw(tlm::tlm_generic_payload &trans,
+                                       tlm::tlm_phase &phase, sc_time &t)
+    {
+        if (&trans == m_req_pending) {
+            m_req_pending = nullptr;
+        }
+
+        if (phase == tlm::END_REQ) {
+            m_ev.notify();
+            return tlm::TLM_ACCEPTED;
+        }
+
+        if (phase != tlm::BEGIN_RESP || ++responses > 1) {
+            violation = true;
+        }
+
+        max_responses = std::max(max_responses, responses);
+
+        if (defer_end_resp) {
+            m_peq.notify(trans, tlm::END_RESP, t + INITIATOR_ACCEPT_TIME);
+            return tlm::TLM_ACCEPTED;
+        }
+
+        complete(trans);
+        return tlm::TLM_COMPLETED;
+    }
+
+    void peq_cb(tlm::tlm_generic_payload &trans, const tlm::tlm_phase &ph)
+    {
+        tlm::tlm_phase phase = tlm::END_RESP;
+        sc_time t = SC_ZERO_TIME;
+
+        complete(trans);
+        socket->nb_transport_fw(trans, phase, t);
+    }
+
+    void complete(tlm::tlm_generic_payload &trans)
+    {
+        responses--;
+        m_done.push_back(&trans);
+        m_ev.notify();
+    }
+
+    void invalidate_direct_mem_ptr(sc_dt::uint64 start, sc_dt::uint64 end)
+    {
+        inval_start = start;
+        inval_end = end;
+    }
+
+    std::vector<tlm::tlm_generic_payload*> m_done;
+
+public:
+    AtInitiator(sc_module_name n)
+        : sc_module(n)
+        , socket("socket")
+        , defer_end_resp(false)
+        , responses(0)
+        , max_responses(0)
+        , violation(false)
+        , inval_start(0)
+        , inval_end(0)
+        , m_peq(this, &AtInitiator::peq_cb)
+        , m_req_pending(nullptr)
+    {
+        socket.register_nb_transport_bw(this, &AtInitiator::nb_transport_bw);
+        socket.register_invalidate_direct_mem_ptr(this, &AtInitiator::invalidate_direct_mem_ptr);
+    }
+
+    /* Send a BEGIN_REQ, after the previous request was accepted */
+    void send(tlm::tlm_generic_payload &trans)
+    {
+        tlm::tlm_phase phase = tlm::BEGIN_REQ;
+        sc_time t = SC_ZERO_TIME;
+
+        while (m_req_pending != nullptr) {
+            wait(m_ev);
+        }
+
+        trans.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+        switch (socket->nb_transport_fw(trans, phase, t)) {
+        case tlm::TLM_COMPLETED:
+            m_done.push_back(&trans);
+            break;
+
+        case tlm::TLM_UPDATED:
+            violation = true;
+            break;
+
+        case tlm::TLM_ACCEPTED:
+            m_req_pending = &trans;
+            break;
+        }
+    }
+
+    bool is_done(tlm::tlm_generic_payload &trans) const
+    {
+        return std::find(m_done.begin(), m_done.end(), &trans) != m_done.end();
+    }
+
+    /* Wait for the response to a transaction, returns false on timeout */
+    bool wait_done(tlm::tlm_generic_payload &trans)
+    {
+        sc_time deadline = sc_time_stamp() + TIMEOUT;
+
+        while (!is_done(trans)) {
+            if (sc_time_stamp() >= deadline) {
+                return false;
+            }
+
+            wait(deadline - sc_time_stamp(), m_ev);
+        }
+
+        return true;
+    }
+};
+
+static Parameters interco_params(ConfigManager &c,
+                                 const sc_time &request_latency = REQUEST_LATENCY,
+                                 const sc_time &response_latency = RESPONSE_LATENCY)
+{
+    ComponentManager::Factory f = c.get_component_manager().find_by_type("simple-bus");
+    Parameters p = f->get_params();
+
+    p["request-latency"].set(request_latency);
+    p["response-latency"].set(response_latency);
+
+    return p;
+}
+
+/* Two initiators and two targets on an interconnect */
+class InterconnectTester : public TestBench {
+protected:
+    Interconnect<> interco;
+    AtInitiator ini0, ini1;
+    AtTarget tgt0, tgt1;
+
+    uint8_t m_data[4];
+
+    void init_trans(tlm::tlm_generic_payload &trans, uint64_t addr)
+    {
+        trans.set_command(tlm::TLM_READ_COMMAND);
+        trans.set_address(addr);
+        trans.set_data_ptr(m_data);
+        trans.set_data_length(sizeof(m_data));
+        trans.set_streaming_width(sizeof(m_data));
+        trans.set_byte_enable_ptr(nullptr);
+        trans.set_dmi_allowed(false);
+    }
+
+    bool no_violation() const
+    {
+        return !(ini0.violation || ini1.violation || tgt0.violation || tgt1.violation);
+    }
+
+    /* Blocking read, returns the simulation time it took */
+    sc_time b_read(AtInitiator &ini, uint64_t addr, sc_time &delay)
+    {
+        tlm::tlm_generic_payload trans;
+        sc_time start = sc_time_stamp();
+
+        init_trans(trans, addr);
+        trans.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+        ini.socket->b_transport(trans, delay);
+        RABBITS_TEST_ASSERT_EQ(trans.get_response_status(), tlm::TLM_OK_RESPONSE);
+
+        return sc_time_stamp() - start;
+    }
+
+public:
+    InterconnectTester(sc_module_name n, ConfigManager &c,
+                       const sc_time &request_latency = REQUEST_LATENCY,
+                       const sc_time &response_latency = RESPONSE_LATENCY)
+        : TestBench(n, c)
+        , interco("interco", interco_params(c, request_latency, response_latency), c)
+        , ini0("ini0"), ini1("ini1")
+        , tgt0("tgt0"), tgt1("tgt1")
+    {
+        interco.connect_initiator(ini0.socket);
+        interco.connect_initiator(ini1.socket);
+        interco.connect_target(tgt0.socket, TARGET0_BASE, TARGET_SIZE);
+        interco.connect_target(tgt1.socket, TARGET1_BASE, TARGET_SIZE);
+    }
+};
+
+class UntimedInterconnectTester : public InterconnectTester {
+public:
+    UntimedInterconnectTester(sc_module_name n, ConfigManager &c)
+        : InterconnectTester(n, c, SC_ZERO_TIME, SC_ZERO_TIME) {}
+};
+
+RABBITS_UNIT_TESTBENCH(at_accept, InterconnectTester)
+{
+    tlm::tlm_generic_payload t0;
+
+    init_trans(t0, TARGET0_BASE + 0x10);
+
+    ini0.send(t0);
+    RABBITS_TEST_ASSERT(ini0.wait_done(t0));
+
+    /* Target local address on the target side, restored for the initiator */
+    RABBITS_TEST_ASSERT_EQ(tgt0.last_address, 0x10);
+    RABBITS_TEST_ASSERT_EQ(t0.get_address(), TARGET0_BASE + 0x10);
+    RABBITS_TEST_ASSERT_EQ(t0.get_response_status(), tlm::TLM_OK_RESPONSE);
+    RABBITS_TEST_ASSERT_EQ(tgt0.end_resps, 1);
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(at_updated_begin_resp, InterconnectTester)
+{
+    tlm::tlm_generic_payload t0, t1;
+
+    tgt0.mode = AtTarget::UPDATED;
+
+    init_trans(t0, TARGET0_BASE);
+    init_trans(t1, TARGET0_BASE + 4);
+
+    /* The initiator completes on the backward call, the target must still
+     * get its END_RESP to send the next response */
+    ini0.send(t0);
+    RABBITS_TEST_ASSERT(ini0.wait_done(t0));
+    RABBITS_TEST_ASSERT_EQ(tgt0.end_resps, 1);
+
+    ini0.send(t1);
+    RABBITS_TEST_ASSERT(ini0.wait_done(t1));
+    RABBITS_TEST_ASSERT_EQ(tgt0.end_resps, 2);
+
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(at_completed, InterconnectTester)
+{
+    tlm::tlm_generic_payload t0;
+
+    tgt0.mode = AtTarget::COMPLETED;
+
+    init_trans(t0, TARGET0_BASE + 0x20);
+
+    /* The initiator still gets a BEGIN_RESP, after the bus latencies */
+    ini0.send(t0);
+    RABBITS_TEST_ASSERT(!ini0.is_done(t0));
+    RABBITS_TEST_ASSERT(ini0.wait_done(t0));
+    RABBITS_TEST_ASSERT_EQ(t0.get_address(), TARGET0_BASE + 0x20);
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(at_request_exclusion, InterconnectTester)
+{
+    tlm::tlm_generic_payload t0, t1;
+
+    init_trans(t0, TARGET0_BASE);
+    init_trans(t1, TARGET0_BASE + 4);
+
+    /* Both requests reach the bus at the same time, the target must only
+     * see the second one after accepting the first */
+    ini0.send(t0);
+    ini1.send(t1);
+
+    RABBITS_TEST_ASSERT(ini0.wait_done(t0));
+    RABBITS_TEST_ASSERT(ini1.wait_done(t1));
+
+    RABBITS_TEST_ASSERT_EQ(tgt0.max_requests, 1);
+    RABBITS_TEST_ASSERT_EQ(tgt0.end_resps, 2);
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(at_response_exclusion, InterconnectTester)
+{
+    tlm::tlm_generic_payload t0, t1;
+
+    ini0.defer_end_resp = true;
+
+    init_trans(t0, TARGET0_BASE);
+    init_trans(t1, TARGET1_BASE);
+
+    /* Both targets respond while the initiator holds the first response,
+     * the second one must wait for its END_RESP */
+    ini0.send(t0);
+    ini0.send(t1);
+
+    RABBITS_TEST_ASSERT(ini0.wait_done(t0));
+    RABBITS_TEST_ASSERT(ini0.wait_done(t1));
+
+    RABBITS_TEST_ASSERT_EQ(ini0.max_responses, 1);
+    RABBITS_TEST_ASSERT_EQ(tgt0.end_resps, 1);
+    RABBITS_TEST_ASSERT_EQ(tgt1.end_resps, 1);
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(dmi_invalidate, InterconnectTester)
+{
+    /* Target local ranges are translated into bus addresses */
+    tgt1.socket->invalidate_direct_mem_ptr(0x10, 0x1f);
+
+    RABBITS_TEST_ASSERT_EQ(ini0.inval_start, TARGET1_BASE + 0x10);
+    RABBITS_TEST_ASSERT_EQ(ini0.inval_end, TARGET1_BASE + 0x1f);
+    RABBITS_TEST_ASSERT_EQ(ini1.inval_start, TARGET1_BASE + 0x10);
+    RABBITS_TEST_ASSERT_EQ(ini1.inval_end, TARGET1_BASE + 0x1f);
+
+    /* and clipped to the target mapping */
+    tgt0.socket->invalidate_direct_mem_ptr(0x80, ~0ull);
+
+    RABBITS_TEST_ASSERT_EQ(ini0.inval_start, TARGET0_BASE + 0x80);
+    RABBITS_TEST_ASSERT_EQ(ini0.inval_end, TARGET0_BASE + TARGET_SIZE - 1);
+}
+
+RABBITS_UNIT_TESTBENCH(dmi_range, InterconnectTester)
+{
+    tlm::tlm_generic_payload trans;
+    tlm::tlm_dmi dmi;
+
+    /* A denied range is translated as well, so that the initiator stops
+     * asking for DMI on the right bus addresses */
+    tgt0.dmi_allowed = false;
+    tgt0.dmi_start = 0x40;
+    tgt0.dmi_end = 0x7f;
+
+    init_trans(trans, TARGET0_BASE + 0x50);
+    RABBITS_TEST_ASSERT(!ini0.socket->get_direct_mem_ptr(trans, dmi));
+    RABBITS_TEST_ASSERT_EQ(tgt0.last_address, 0x50);
+    RABBITS_TEST_ASSERT_EQ(dmi.get_start_address(), TARGET0_BASE + 0x40);
+    RABBITS_TEST_ASSERT_EQ(dmi.get_end_address(), TARGET0_BASE + 0x7f);
+
+    /* A granted range is clipped to the target mapping */
+    tgt1.dmi_allowed = true;
+    tgt1.dmi_start = 0;
+    tgt1.dmi_end = ~0ull;
+
+    init_trans(trans, TARGET1_BASE + 0x10);
+    RABBITS_TEST_ASSERT(ini0.socket->get_direct_mem_ptr(trans, dmi));
+    RABBITS_TEST_ASSERT_EQ(dmi.get_start_address(), TARGET1_BASE);
+    RABBITS_TEST_ASSERT_EQ(dmi.get_end_address(), TARGET1_BASE + TARGET_SIZE - 1);
+}
+
+RABBITS_UNIT_TESTBENCH(mixed_transport, InterconnectTester)
+{
+    tlm::tlm_generic_payload t0, t1;
+    sc_time delay = SC_ZERO_TIME;
+
+    init_trans(t0, TARGET0_BASE);
+    init_trans(t1, TARGET0_BASE + 4);
+
+    /* Blocking accesses go straight to the target, even while it holds
+     * non-blocking transactions */
+    ini0.send(t0);
+    ini0.send(t1);
+    b_read(ini1, TARGET0_BASE + 0x40, delay);
+    RABBITS_TEST_ASSERT_EQ(tgt0.last_address, 0x40);
+
+    RABBITS_TEST_ASSERT(ini0.wait_done(t0));
+    RABBITS_TEST_ASSERT(ini0.wait_done(t1));
+
+    b_read(ini1, TARGET0_BASE + 0x80, delay);
+    RABBITS_TEST_ASSERT_EQ(tgt0.last_address, 0x80);
+
+    RABBITS_TEST_ASSERT_EQ(tgt0.max_requests, 1);
+    RABBITS_TEST_ASSERT_EQ(tgt0.end_resps, 2);
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(untimed_mixed_transport, UntimedInterconnectTester)
+{
+    tlm::tlm_generic_payload trans[8];
+    sc_time delay = SC_ZERO_TIME;
+
+    /* With zero latencies, early completed transactions are freed in the
+     * same delta cycles as the requests queued behind them */
+    tgt0.mode = AtTarget::COMPLETED;
+
+    for (int i = 0; i < 8; i++) {
+        init_trans(trans[i], TARGET0_BASE + 4 * i);
+        ((i % 2) ? ini1 : ini0).send(trans[i]);
+
+        if (i % 3 == 0) {
+            b_read(ini1, TARGET0_BASE + 0x40, delay);
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        RABBITS_TEST_ASSERT(((i % 2) ? ini1 : ini0).wait_done(trans[i]));
+    }
+
+    RABBITS_TEST_ASSERT_EQ(delay, SC_ZERO_TIME);
+    RABBITS_TEST_ASSERT(no_violation());
+}
+
+RABBITS_UNIT_TESTBENCH(b_transport_latency, InterconnectTester)
+{
+    sc_time delay = SC_ZERO_TIME;
+
+    /* Not decoupled, both latencies are waited for */
+    RABBITS_TEST_ASSERT_EQ(b_read(ini0, TARGET0_BASE, delay),
+                           REQUEST_LATENCY + RESPONSE_LATENCY);
+    RABBITS_TEST_ASSERT_EQ(delay, SC_ZERO_TIME);
+    RABBITS_TEST_ASSERT_EQ(tgt0.last_address, 0);
+}
+
+RABBITS_UNIT_TESTBENCH(b_transport_zero_latency, UntimedInterconnectTester)
+{
+    sc_time delay = SC_ZERO_TIME;
+    sc_dt::uint64 deltas = sc_delta_count();
+
+    /* No context switch at all, not even a delta cycle */
+    RABBITS_TEST_ASSERT_EQ(b_read(ini0, TARGET1_BASE + 0x10, delay), SC_ZERO_TIME);
+    RABBITS_TEST_ASSERT_EQ(sc_delta_count(), deltas);
+    RABBITS_TEST_ASSERT_EQ(delay, SC_ZERO_TIME);
+    RABBITS_TEST_ASSERT_EQ(tgt1.last_address, 0x10);
+}
+
+RABBITS_UNIT_TESTBENCH(decode_cache, InterconnectTester)
+{
+    tlm::tlm_generic_payload trans[8];
+
+    /* Sequential accesses to one target only miss once */
+    for (int i = 0; i < 4; i++) {
+        init_trans(trans[i], TARGET0_BASE + 4 * i);
+        ini0.send(trans[i]);
+        RABBITS_TEST_ASSERT(ini0.wait_done(trans[i]));
+    }
+
+    RABBITS_TEST_ASSERT_EQ(interco.get_decode_hits(0), 3);
+    RABBITS_TEST_ASSERT_EQ(interco.get_decode_misses(0), 1);
+
+    /* Alternating between targets always misses */
+    for (int i = 4; i < 8; i++) {
+        init_trans(trans[i], (i % 2) ? TARGET0_BASE : TARGET1_BASE);
+        ini0.send(trans[i]);
+        RABBITS_TEST_ASSERT(ini0.wait_done(trans[i]));
+    }
+
+    RABBITS_TEST_ASSERT_EQ(interco.get_decode_hits(0), 3);
+    RABBITS_TEST_ASSERT_EQ(interco.get_decode_misses(0), 5);
+
+    /* Caches are per initiator */
+    RABBITS_TEST_ASSERT_EQ(interco.get_decode_hits(1), 0);
+    RABBITS_TEST_ASSERT_EQ(interco.get_decode_misses(1), 0);
+}
+
+/* Interconnect with its address decoder exposed, no target bound */
+class DecoderInterconnect : public Interconnect<> {
+public:
+    DecoderInterconnect(sc_module_name n, const Parameters &p, ConfigManager &c)
+        : Interconnect<>(n, p, c) {}
+
+    void map(int target, uint64_t begin, uint64_t end)
+    {
+        TargetMapping m;
+
+        m.target_index = target;
+        m.begin = begin;
+        m.end = end;
+
+        insert_range(m);
+    }
+
+    int decode(uint64_t addr) const
+    {
+        const TargetMapping *m = find_mapping(addr);
+
+        return (m == nullptr) ? -1 : m->target_index;
+    }
+
+    size_t mapping_count() const { return m_ranges.size(); }
+};
+
+class DecoderTester : public TestBench {
+protected:
+    DecoderInterconnect interco;
+
+    /* Only there so that the interconnect sockets are bound */
+    AtInitiator ini;
+    AtTarget tgt;
+
+    /* Returns true if mapping the range aborts the simulation */
+    bool map_aborts(int target, uint64_t begin, uint64_t end)
+    {
+        int status;
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            interco.get_logger(LogContext::APP).mute();
+            interco.map(target, begin, end);
+            _exit(0);
+        }
+
+        waitpid(pid, &status, 0);
+        return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+    }
+
+public:
+    DecoderTester(sc_module_name n, ConfigManager &c)
+        : TestBench(n, c)
+        , interco("interco", interco_params(c), c)
+        , ini("ini"), tgt("tgt")
+    {
+        interco.connect_initiator(ini.socket);
+
+        /* Bound without any mapping */
+        interco.get_logger(LogContext::APP).mute();
+        interco.connect_target(tgt.socket, 0, 0);
+        interco.get_logger(LogContext::APP).unmute();
+    }
+};
+
+RABBITS_UNIT_TESTBENCH(decode_boundaries, DecoderTester)
+{
+    interco.map(1, 0x2000, 0x3000);
+    interco.map(0, 0x1000, 0x2000);
+
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x0fff), -1);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x1000), 0);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x1fff), 0);
+
+    /* Adjacent range, inserted first */
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x2000), 1);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x2fff), 1);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x3000), -1);
+}
+
+RABBITS_UNIT_TESTBENCH(decode_overlap, DecoderTester)
+{
+    interco.map(0, 0x1000, 0x2000);
+    interco.map(1, 0x3000, 0x4000);
+
+    RABBITS_TEST_ASSERT(map_aborts(2, 0x1800, 0x2800));
+    RABBITS_TEST_ASSERT(map_aborts(2, 0x2800, 0x3001));
+    RABBITS_TEST_ASSERT(map_aborts(2, 0x0000, 0x5000));
+    RABBITS_TEST_ASSERT(map_aborts(2, 0x3800, 0x3900));
+
+    /* Filling the hole exactly is fine */
+    RABBITS_TEST_ASSERT(!map_aborts(2, 0x2000, 0x3000));
+}
+
+RABBITS_UNIT_TESTBENCH(decode_empty_mapping, DecoderTester)
+{
+    interco.get_logger(LogContext::APP).mute();
+
+    /* An empty mapping inside a range must not hide its upper part, nor
+     * make a later range look overlapping */
+    interco.map(0, 0x1000, 0x2000);
+    interco.map(1, 0x1800, 0x1800);
+    interco.map(2, 0x3000, 0x3000);
+    interco.map(3, 0x2800, 0x3800);
+
+    interco.get_logger(LogContext::APP).unmute();
+
+    RABBITS_TEST_ASSERT_EQ(interco.mapping_count(), 2);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x1800), 0);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x1fff), 0);
+    RABBITS_TEST_ASSERT_EQ(interco.decode(0x3000), 3);
+}
@@ -19,6 +19,8 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <csignal>
 #include <unistd.h>
 #include <sys/types.h>
@@ -26,32 +28,256 @@
 #include <rabbits/logger.h>
 
 #include "pl011.h"
+#include "hotpath_log.h"
 
 using namespace sc_core;
 
 void Pl011::read_thread()
 {
     std::vector<uint8_t> data;
-    int pos;
 
     while(1) {
         p_uart.recv(data);
         for (auto c : data) {
             MLOG_F(APP, TRC, "rcv_thread: got a char (0x%02x)\n", c);
 
-            while (state.read_count == READ_BUF_SIZE)
-                wait(evRead);
+            /* Characters arrive at the line rate */
+            if (char_time != SC_ZERO_TIME)
+                wait(char_time);
 
-            pos = (state.read_pos + state.read_count) % READ_BUF_SIZE;
-            state.read_buf[pos] = c;
-            state.read_count++;
+            /* Do not overrun on backend input, wait for the guest instead */
+            while (!rx_push(c))
+                wait(evRead);
         }
-        /*Interrupt RX*/
-        state.int_pending = 1;
-        state.int_rx = 1;
+    }
+
+}
+
+int Pl011::fifo_depth() const
+{
+    return (state.lcrh & UART_LCRH_FEN) ? fifo_size : 1;
+}
+
+/* Number of FIFO entries matching a UART_IFLS level selection */
+int Pl011::trigger_level(uint8_t sel) const
+{
+    static const int eighths[] = { 1, 2, 4, 6, 7 };
+
+    if (!(state.lcrh & UART_LCRH_FEN)) {
+        return 1;
+    }
+
+    if (sel >= sizeof(eighths) / sizeof(eighths[0])) {
+        sel = 2;
+    }
+
+    return fifo_size * eighths[sel] / 8;
+}
+
+/* Update the raw interrupt status. The IRQ line is only reevaluated when it
+ * changes, the mask being untouched here. */
+void Pl011::set_int_level(uint16_t level)
+{
+    if (level != state.int_level) {
+        state.int_level = level;
         irq_update.notify();
     }
+}
+
+bool Pl011::rx_push(uint8_t c)
+{
+    int pos;
+
+    if (state.read_count >= fifo_depth()) {
+        return false;
+    }
 
+    pos = (state.read_pos + state.read_count) % FIFO_MAX_DEPTH;
+    state.read_buf[pos] = c;
+    state.read_count++;
+
+    if (state.read_count >= trigger_level(state.rx_irq_lvl)) {
+        set_int_level(state.int_level | UART_INT_RX);
+    }
+
+    if (state.dmacr) {
+        dma_update.notify();
+    }
+
+    /* Restart the receive timeout */
+    evRxTimeout.cancel();
+    evRxTimeout.notify(rx_timeout);
+
+    return true;
+}
+
+/* The TX interrupt is raised at or below the trigger level, or when the
+ * holding register is empty if FIFOs are disabled. In instant timing mode,
+ * the TX FIFO is always empty. */
+void Pl011::tx_update()
+{
+    int lvl = (state.lcrh & UART_LCRH_FEN) ? trigger_level(state.tx_irq_lvl) : 0;
+
+    if (state.tx_count <= lvl) {
+        set_int_level(state.int_level | UART_INT_TX);
+    } else {
+        set_int_level(state.int_level & ~UART_INT_TX);
+    }
+
+    if (state.dmacr) {
+        dma_update.notify();
+    }
+}
+
+void Pl011::tx_send(uint8_t c)
+{
+    if (state.uart_loopback) {
+        if (!rx_push(c)) {
+            state.rsr |= UART_RSR_OE;
+            set_int_level(state.int_level | UART_INT_OE);
+        }
+    } else {
+        tx_push(c);
+    }
+}
+
+void Pl011::update_timing()
+{
+    uint64_t divisor = uint64_t(state.uart_baudrate_divisor) * 64
+        + state.uart_frac_baudrate_divisor;
+
+    if (!timing_accurate || divisor == 0 || clock_frequency == 0) {
+        char_time = SC_ZERO_TIME;
+        rx_timeout = rx_timeout_param;
+        return;
+    }
+
+    /* Baud rate is clock / (16 * (IBRD + FBRD / 64)) */
+    double bit_time = double(divisor) / (4.0 * clock_frequency);
+    int bits = 1 + state.data_size
+        + ((state.lcrh & UART_LCRH_PEN) ? 1 : 0)
+        + ((state.lcrh & UART_LCRH_STP2) ? 2 : 1);
+
+    char_time = sc_time(bit_time * bits, SC_SEC);
+
+    /* As the hardware, 32 bit periods */
+    rx_timeout = sc_time(bit_time * 32, SC_SEC);
+}
+
+void Pl011::tx_thread()
+{
+    uint8_t c;
+
+    while (1) {
+        while (state.tx_count == 0)
+            wait(evTxStart);
+
+        wait(char_time);
+
+        c = state.tx_fifo[state.tx_pos];
+        state.tx_count--;
+        if (++state.tx_pos == FIFO_MAX_DEPTH) {
+            state.tx_pos = 0;
+        }
+
+        tx_send(c);
+        tx_update();
+        evTxSpace.notify();
+    }
+}
+
+void Pl011::rx_timeout_thread()
+{
+    while (1) {
+        wait(evRxTimeout);
+
+        if (state.read_count) {
+            set_int_level(state.int_level | UART_INT_RT);
+        }
+    }
+}
+
+/* Called after characters have been read from the RX FIFO */
+void Pl011::rx_update()
+{
+    uint16_t level = state.int_level;
+
+    if (state.read_count < trigger_level(state.rx_irq_lvl)) {
+        level &= ~UART_INT_RX;
+    }
+
+    if (0 == state.read_count) {
+        level &= ~UART_INT_RT;
+    }
+
+    set_int_level(level);
+    evRead.notify(0, SC_NS);
+
+    if (state.dmacr) {
+        dma_update.notify();
+    }
+}
+
+void Pl011::dr_write(uint8_t c)
+{
+    if (char_time == SC_ZERO_TIME) {
+        tx_send(c);
+    } else if (state.tx_count < fifo_depth()) {
+        int pos = (state.tx_pos + state.tx_count) % FIFO_MAX_DEPTH;
+
+        state.tx_fifo[pos] = c;
+        state.tx_count++;
+        evTxStart.notify();
+    } else {
+        /* As the hardware, writes to a full FIFO are lost */
+        MLOG(SIM, DBG) << "TX FIFO overflow\n";
+    }
+}
+
+uint8_t Pl011::dr_read()
+{
+    uint8_t c;
+
+    if (state.read_count == 0) {
+        return 0;
+    }
+
+    c = state.read_buf[state.read_pos];
+    state.read_count--;
+    if (++state.read_pos == FIFO_MAX_DEPTH) {
+        state.read_pos = 0;
+    }
+
+    return c;
+}
+
+/*
+ * RX requests are raised when the RX FIFO holds a character (single) or
+ * reaches its trigger level (burst), TX requests when the TX FIFO has a free
+ * entry (single) or is at or below its trigger level (burst). With
+ * DMAONERR, RX requests are masked while an error interrupt is pending.
+ */
+void Pl011::dma_update_thread()
+{
+    while (1) {
+        bool rx_en, tx_en;
+        int tx_lvl;
+
+        wait(dma_update);
+
+        rx_en = (state.dmacr & UART_DMACR_RXDMAE)
+            && !((state.dmacr & UART_DMACR_DMAONERR)
+                 && (state.int_level & UART_INT_ERR));
+        tx_en = state.dmacr & UART_DMACR_TXDMAE;
+
+        tx_lvl = (state.lcrh & UART_LCRH_FEN) ? trigger_level(state.tx_irq_lvl) : 0;
+
+        p_rx_dma_sreq.sc_p = rx_en && state.read_count > 0;
+        p_rx_dma_breq.sc_p = rx_en
+            && state.read_count >= trigger_level(state.rx_irq_lvl);
+        p_tx_dma_sreq.sc_p = tx_en && state.tx_count < fifo_depth();
+        p_tx_dma_breq.sc_p = tx_en && state.tx_count <= tx_lvl;
+    }
 }
 
 void Pl011::Pl011_init_register(void)
@@ -63,17 +289,97 @@ Pl011::Pl011(sc_core::sc_module_name name, const Parameters &params, ConfigManag
     : Slave(name, params, c)
     , p_irq("irq")
     , p_uart("uart")
+    , p_tx_dma_sreq("tx-dma-sreq")
+    , p_tx_dma_breq("tx-dma-breq")
+    , p_rx_dma_sreq("rx-dma-sreq")
+    , p_rx_dma_breq("rx-dma-breq")
 {
     Pl011_init_register();
 
+    fifo_size = params["fifo-depth"].as<uint32_t>();
+    rx_timeout_param = params["rx-timeout"].as<sc_time>();
+    clock_frequency = params["clock-frequency"].as<uint64_t>();
+
+    if (fifo_size != 16 && fifo_size != 32) {
+        MLOG(APP, WRN) << "Invalid FIFO depth " << fifo_size << ". Falling back to 16.\n";
+        fifo_size = 16;
+    }
+
+    tx_buf_size = params["tx-buffer-size"].as<uint32_t>();
+    tx_timeout = params["tx-flush-timeout"].as<sc_time>();
+
+    if (tx_buf_size == 0) {
+        tx_buf_size = 1;
+    }
+
+    tx_buf.reserve(tx_buf_size);
+
+    std::string timing = params["timing"].as<std::string>();
+
+    if (timing == "instant") {
+        timing_accurate = false;
+    } else if (timing == "accurate") {
+        timing_accurate = true;
+    } else {
+        MLOG(APP, WRN) << "Unknown timing mode `" << timing << "`. Falling back to instant.\n";
+        timing_accurate = false;
+    }
+
+    update_timing();
+
     SC_THREAD(read_thread);
     SC_THREAD(irq_update_thread);
+    SC_THREAD(tx_flush_thread);
+    SC_THREAD(rx_timeout_thread);
+    SC_THREAD(dma_update_thread);
+
+    if (timing_accurate) {
+        SC_THREAD(tx_thread);
+    }
 }
 
 Pl011::~Pl011()
 {
 }
 
+void Pl011::tx_push(uint8_t c)
+{
+    tx_buf.push_back(c);
+
+    if (c == '\n' || tx_buf.size() >= tx_buf_size) {
+        tx_flush();
+    } else if (tx_buf.size() == 1) {
+        evTxFlush.notify(tx_timeout);
+    }
+}
+
+void Pl011::tx_flush()
+{
+    evTxFlush.cancel();
+
+    if (tx_buf.empty()) {
+        return;
+    }
+
+    p_uart.send(tx_buf);
+
+    /* Keeps the allocated capacity */
+    tx_buf.clear();
+}
+
+void Pl011::tx_flush_thread()
+{
+    while (1) {
+        wait(evTxFlush);
+        tx_flush();
+    }
+}
+
+void Pl011::end_of_simulation()
+{
+    tx_flush();
+}
+
 void Pl011::irq_update_thread()
 {
     unsigned long flags;
@@ -82,20 +388,99 @@ void Pl011::irq_update_thread()
 
         wait(irq_update);
 
-        flags = (state.int_rx || state.int_tx) & state.int_pending;
+        flags = state.int_level & state.irq_mask;
 
-        MLOG_F(SIM, DBG, "%s - %s\n", __FUNCTION__, (flags != 0) ? "1" : "0");
+        HOTPATH_MLOG_F(SIM, DBG, "%s - %s\n", __FUNCTION__, (flags != 0) ? "1" : "0");
 
         p_irq.sc_p = (flags != 0);
     }
 }
 
+/*
+ * Streaming accesses to UART_DR, as issued by a DMA controller, carry one
+ * character per beat of the streaming width. A read asking for more
+ * characters than the RX FIFO holds fails as a whole, leaving the FIFO
+ * untouched. In accurate timing mode, a write stalls while the TX FIFO is
+ * full instead of losing characters. Other accesses go through
+ * bus_cb_read/bus_cb_write.
+ */
+void Pl011::b_transport(tlm::tlm_generic_payload &trans, sc_time &delay)
+{
+    uint8_t *data = trans.get_data_ptr();
+    unsigned int len = trans.get_data_length();
+    unsigned int width = trans.get_streaming_width();
+    unsigned int beats, i;
+
+    if ((trans.get_address() >> 2) != UART_DR || width == 0 || width >= len) {
+        Slave<>::b_transport(trans, delay);
+        return;
+    }
+
+    if (len % width) {
+        MLOG(SIM, DBG) << "UART_DR access of " << len
+                       << " bytes is not a multiple of the streaming width "
+                       << width << "\n";
+        trans.set_response_status(tlm::TLM_BURST_ERROR_RESPONSE);
+        return;
+    }
+
+    beats = len / width;
+
+    switch (trans.get_command()) {
+    case tlm::TLM_READ_COMMAND:
+        if (state.read_count < int(beats)) {
+            MLOG(SIM, DBG) << "UART_DR read of " << beats << " characters, "
+                           << state.read_count << " available\n";
+            trans.set_response_status(tlm::TLM_GENERIC_ERROR_RESPONSE);
+            return;
+        }
+
+        std::memset(data, 0, len);
+
+        for (i = 0; i < beats; i++) {
+            uint32_t c = dr_read();
+            std::memcpy(data + i * width, &c, std::min(width, unsigned(sizeof(c))));
+        }
+
+        rx_update();
+        break;
+
+    case tlm::TLM_WRITE_COMMAND:
+        for (i = 0; i < beats; i++) {
+            uint32_t c = 0;
+            std::memcpy(&c, data + i * width, std::min(width, unsigned(sizeof(c))));
+
+            while (char_time != SC_ZERO_TIME && state.tx_count >= fifo_depth()) {
+                /* Publish the full FIFO, then catch up with the initiator
+                 * local time before waiting for the transmitter */
+                tx_update();
+
+                if (delay != SC_ZERO_TIME) {
+                    wait(delay);
+                    delay = SC_ZERO_TIME;
+                }
+
+                wait(evTxSpace);
+            }
+
+            dr_write(c);
+        }
+
+        tx_update();
+        break;
+
+    default:
+        trans.set_response_status(tlm::TLM_COMMAND_ERROR_RESPONSE);
+        return;
+    }
+
+    trans.set_response_status(tlm::TLM_OK_RESPONSE);
+}
+
 void Pl011::bus_cb_write(uint64_t ofs, uint8_t *data,
                                   unsigned int len, bool &bErr)
 {
-    uint8_t ch = 0;
     uint32_t value;
-    uint32_t pos;
 
     bErr = false;
 
@@ -105,66 +490,41 @@ void Pl011::bus_cb_write(uint64_t ofs, uint8_t *data,
 #if 0
     if (ofs != 0)
 #endif
-    MLOG_F(SIM, DBG, "%s to 0x%lx - value 0x%lx\n", __FUNCTION__, (unsigned long) ofs,
+    HOTPATH_MLOG_F(SIM, DBG, "%s to 0x%lx - value 0x%lx\n", __FUNCTION__, (unsigned long) ofs,
             (unsigned long) value);
 
     switch (ofs) {
 
     case UART_DR:
         if (true || state.uart_enabled) {
-            if (state.uart_loopback) {
-                /*fifos disable*/
-                if (!(state.lcrh >> 4) & 1) {
-                    state.read_single = value;
-                    /*clear tx interrupt*/
-                    if (state.int_pending & state.int_tx) {
-                        state.int_tx = 0;
-                        if (state.int_rx == 0) {
-                            state.int_pending = 0;
-                            irq_update.notify();
-                        }
-                    }
-                } else {
-                    while (state.read_count == READ_BUF_SIZE)
-                        wait(evRead);
-
-                    pos = (state.read_pos + state.read_count) % READ_BUF_SIZE;
-                    state.read_buf[pos] = ch;
-                    state.read_count++;
-                }
-            } else {
-                ch = value;
-                std::vector<uint8_t> data;
-                data.push_back(ch);
-                p_uart.send(data);
-            }
+            dr_write(value);
+            tx_update();
         }
         break;
 
     case UART_RSRECR:
+        state.rsr = 0;
+        break;
+
     case UART_FR:
     case UART_ILPR:
         break;
 
     case UART_IBRD:
         state.uart_baudrate_divisor = value & 0xFFFF;
+        update_timing();
         break;
 
     case UART_FBRD:
         state.uart_frac_baudrate_divisor = value & 0x3F;
+        update_timing();
         break;
 
     case UART_LCRH:
         state.data_size = ((value >> 5) & 0x3) + 5;
         state.lcrh = value & 0xFF;
-        /*set interrupt tx*/
-        /*fifos enable : perfect fifos -> tx interrupt*/
-        /*fifos disable -> tx interrupt*/
-        if (UART_MASK_TX(state.irq_mask)) {
-            state.int_tx = 1;
-            state.int_pending = 1;
-            irq_update.notify();
-        }
+        update_timing();
+        tx_update();
         break;
 
     case UART_CR:
@@ -179,42 +539,30 @@ void Pl011::bus_cb_write(uint64_t ofs, uint8_t *data,
     case UART_IFLS:
         state.rx_irq_lvl = (value >> 3) & 0x7;
         state.tx_irq_lvl = value & 0x7;
+        tx_update();
         break;
 
     case UART_IMSC:
-        state.irq_mask = value & 0x7FF;
-        if (UART_MASK_TX(state.irq_mask) == 1) {
-            state.int_tx = 1;
-            state.int_pending = 1;
+        if ((value & UART_INT_ALL) != state.irq_mask) {
+            state.irq_mask = value & UART_INT_ALL;
             irq_update.notify();
-        } else {
-            state.int_tx = 0;
-            if (state.int_rx == 0) {
-                state.int_pending = 0;
-                irq_update.notify();
-            }
         }
         break;
 
     case UART_ICR:
-        if (state.int_rx && ((UART_MASK_RX(value)))) {
-            state.int_rx = 0;
-            if (state.int_tx == 0) {
-                state.int_pending = 0;
-                irq_update.notify();
-            }
-        }
-        if (state.int_tx && ((UART_MASK_TX(value)))) {
-            state.int_tx = 0;
-            if (state.int_rx == 0) {
-                state.int_pending = 0;
-                irq_update.notify();
-            }
-        }
+        set_int_level(state.int_level & ~value);
 
+        if (state.dmacr) {
+            dma_update.notify();
+        }
         break;
 
     case UART_DMACR:
+        state.dmacr = value & (UART_DMACR_RXDMAE | UART_DMACR_TXDMAE
+                               | UART_DMACR_DMAONERR);
+        dma_update.notify();
+        break;
+
     case UART_ITCR:
     case UART_ITIP:
     case UART_ITOP:
@@ -240,44 +588,38 @@ void Pl011::bus_cb_read(uint64_t ofs, uint8_t *data,
     bErr = false;
 
     ofs >>= 2;
-    MLOG_F(SIM, DBG, "%s to 0x%lx\n", __FUNCTION__, (unsigned long) ofs);
+    HOTPATH_MLOG_F(SIM, DBG, "%s to 0x%lx\n", __FUNCTION__, (unsigned long) ofs);
 
     switch (ofs) {
     case UART_DR:
-        /*fifos enable*/
-        if ((state.lcrh >> 4) & 1) {
-            c = state.read_buf[state.read_pos];
-            if (state.read_count > 0) {
-                state.read_count--;
-                if (++state.read_pos == READ_BUF_SIZE) {
-                    state.read_pos = 0;
-                }
-
-                if (0 == state.read_count) {
-                    state.int_rx = 0;
-                    if (state.int_tx == 0) {
-                        state.int_pending = 0;
-                        irq_update.notify();
-                    }
-                }
-
-                evRead.notify(0, SC_NS);
-            }
-        } else {
-            c = state.read_single;
+        c = 0;
+        if (state.read_count > 0) {
+            c = dr_read();
+            rx_update();
         }
         *pdata = c;
         break;
 
     case UART_RSRECR:
-        *pdata = 0;
+        *pdata = state.rsr;
         break;
 
     case UART_FR:
-        int buf_full, buf_empty;
-        buf_full = (state.read_count == READ_BUF_SIZE) ? 1 : 0;
-        buf_empty = (state.read_count == 0) ? 1 : 0;
-        *pdata = 1 << 7 | buf_full << 6 | buf_empty << 4;
+        *pdata = 0;
+        if (state.tx_count == 0) {
+            *pdata |= UART_FR_TXFE;
+        } else {
+            *pdata |= UART_FR_BUSY;
+        }
+        if (state.tx_count >= fifo_depth()) {
+            *pdata |= UART_FR_TXFF;
+        }
+        if (state.read_count >= fifo_depth()) {
+            *pdata |= UART_FR_RXFF;
+        }
+        if (state.read_count == 0) {
+            *pdata |= UART_FR_RXFE;
+        }
         break;
 
     case UART_ILPR:
@@ -310,13 +652,11 @@ void Pl011::bus_cb_read(uint64_t ofs, uint8_t *data,
         break;
 
     case UART_RIS:
-        *pdata = state.int_rx << 4 | state.int_tx << 5;
+        *pdata = state.int_level;
         break;
 
     case UART_MIS:
-        /*type of interrupt*/
-        *pdata = ((state.int_rx && UART_MASK_RX(state.irq_mask)) << 4)
-                | ((state.int_tx && UART_MASK_TX(state.irq_mask)) << 5);
+        *pdata = state.int_level & state.irq_mask;
         break;
 
     case UART_ICR:
@@ -324,7 +664,7 @@ void Pl011::bus_cb_read(uint64_t ofs, uint8_t *data,
         break;
 
     case UART_DMACR:
-        *pdata = 0;
+        *pdata = state.dmacr;
         break;
 
     case UART_ITCR:
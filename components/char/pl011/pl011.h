@@ -20,11 +20,13 @@
 #ifndef _PL011_H
 #define _PL011_H
 
+#include <vector>
+
 #include <rabbits/component/slave.h>
 #include <rabbits/component/port/out.h>
 #include <rabbits/component/port/uart.h>
 
-#define READ_BUF_SIZE           256
+#define FIFO_MAX_DEPTH          32
 
 #define AMBA_CID 0xB105F00D
 #define PID 0x00041011
@@ -56,15 +58,34 @@
 #define UART_CID2            0x3FE
 #define UART_CID3            0x3FF
 
-#define UART_MASK_TX(reg)       ((reg >> 5) & 1)
-#define UART_MASK_RX(reg)       ((reg >> 4) & 1)
+/* Interrupt bits, in UART_RIS, UART_MIS, UART_IMSC and UART_ICR */
+#define UART_INT_RX             (1 << 4)
+#define UART_INT_TX             (1 << 5)
+#define UART_INT_RT             (1 << 6)
+#define UART_INT_OE             (1 << 10)
+#define UART_INT_ERR            0x780 /* FE, PE, BE and OE */
+#define UART_INT_ALL            0x7FF
+
+#define UART_FR_BUSY            (1 << 3)
+#define UART_FR_RXFE            (1 << 4)
+#define UART_FR_TXFF            (1 << 5)
+#define UART_FR_RXFF            (1 << 6)
+#define UART_FR_TXFE            (1 << 7)
+
+#define UART_LCRH_PEN           (1 << 1)
+#define UART_LCRH_STP2          (1 << 3)
+#define UART_LCRH_FEN           (1 << 4)
+
+#define UART_RSR_OE             (1 << 3)
+
+#define UART_DMACR_RXDMAE       (1 << 0)
+#define UART_DMACR_TXDMAE       (1 << 1)
+#define UART_DMACR_DMAONERR     (1 << 2)
 
 struct tty_state
 {
-
-    unsigned long int_pending;
-    unsigned long int_rx;
-    unsigned long int_tx;
+    uint16_t int_level; /* Raw interrupt status */
+    uint16_t irq_mask;
 
     uint8_t uart_enabled;
     uint8_t uart_rx_enable;
@@ -83,13 +104,18 @@ struct tty_state
     uint8_t rx_irq_lvl;
     uint8_t tx_irq_lvl;
 
-    uint16_t irq_mask;
+    uint8_t rsr;
+    uint8_t dmacr;
 
-    uint8_t read_single;
-    uint8_t read_buf[READ_BUF_SIZE];
+    /* RX FIFO, of depth 1 when FIFOs are disabled */
+    uint8_t read_buf[FIFO_MAX_DEPTH];
     int read_pos;
     int read_count;
-    int read_trigger;
+
+    /* TX FIFO, only filled in accurate timing mode */
+    uint8_t tx_fifo[FIFO_MAX_DEPTH];
+    int tx_pos;
+    int tx_count;
 };
 
 class Pl011 : public Slave<>
@@ -100,6 +126,8 @@ public:
     virtual ~Pl011();
 
 private:
+    virtual void b_transport(tlm::tlm_generic_payload &trans, sc_core::sc_time &delay);
+
     void bus_cb_read(uint64_t addr, uint8_t *data, unsigned int len,
             bool &bErr);
     void bus_cb_write(uint64_t addr, uint8_t *data, unsigned int len,
@@ -109,14 +137,65 @@ private:
     void read_thread();
     void irq_update_thread();
 
+    void tx_push(uint8_t c);
+    void tx_flush();
+    void tx_flush_thread();
+
+    int fifo_depth() const;
+    int trigger_level(uint8_t sel) const;
+    void set_int_level(uint16_t level);
+    bool rx_push(uint8_t c);
+    void rx_update();
+    void tx_update();
+    void tx_send(uint8_t c);
+    void rx_timeout_thread();
+
+    void update_timing();
+    void tx_thread();
+
+    void dr_write(uint8_t c);
+    uint8_t dr_read();
+    void dma_update_thread();
+
     void Pl011_init_register(void);
 
 public:
     OutPort<bool> p_irq;
     UartPort p_uart;
 
+    /* DMA requests, as UARTTXDMASREQ/BREQ and UARTRXDMASREQ/BREQ. Single
+     * requests ask for one character, burst requests for a FIFO trigger
+     * level worth of characters. */
+    OutPort<bool> p_tx_dma_sreq;
+    OutPort<bool> p_tx_dma_breq;
+    OutPort<bool> p_rx_dma_sreq;
+    OutPort<bool> p_rx_dma_breq;
+
+    void end_of_simulation();
+
 private:
     sc_core::sc_event evRead;
+    sc_core::sc_event dma_update;
+
+    int fifo_size;
+    sc_core::sc_time rx_timeout;
+    sc_core::sc_event evRxTimeout;
+
+    /* Accurate timing mode: characters take char_time on the line,
+     * derived from the baud rate divisors and the reference clock */
+    bool timing_accurate;
+    uint64_t clock_frequency;
+    sc_core::sc_time char_time;
+    sc_core::sc_time rx_timeout_param;
+    sc_core::sc_event evTxStart;
+    sc_core::sc_event evTxSpace;
+
+    /* TX staging buffer, sent to the backend on newline, when full or
+     * after tx_timeout */
+    std::vector<uint8_t> tx_buf;
+    unsigned int tx_buf_size;
+    sc_core::sc_time tx_timeout;
+    sc_core::sc_event evTxFlush;
 
     tty_state state;
 };
@@ -0,0 +1,488 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2015  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define RABBITS_TEST_MOD pl011
+
+#include <rabbits/test/test.h>
+#include <rabbits/test/slave_tester.h>
+
+#include <cstring>
+
+#include <rabbits/component/port/in.h>
+#include <rabbits/component/port/uart.h>
+
+#include "pl011.h"
+
+using namespace sc_core;
+
+const sc_time RX_TIMEOUT(1, SC_US);
+const sc_time TX_FLUSH_TIMEOUT(2, SC_US);
+
+/* Characters staged before being sent to the backend */
+const int TX_BUFFER_SIZE = 8;
+
+/* 16 entries FIFOs, RX and TX trigger levels at half full */
+const int FIFO_DEPTH = 16;
+const int RX_TRIGGER = 8;
+
+#define REG(r) ((r) << 2)
+
+/*
+ * Characters are received through the internal loopback, written to UART_DR
+ * and pushed into the RX FIFO, which does not need a backend. Without
+ * loopback, what the UART sends to its backend is recorded in `sent'.
+ */
+class Pl011Tester : public TestBench {
+protected:
+    ComponentBase *uart;
+    SlaveTester<> tst;
+    UartPort p_uart;
+
+    InPort<bool> p_tx_dma_sreq;
+    InPort<bool> p_tx_dma_breq;
+    InPort<bool> p_rx_dma_sreq;
+    InPort<bool> p_rx_dma_breq;
+
+    /* Batches sent by the UART and when they were received */
+    std::vector<std::string> sent;
+    std::vector<sc_time> sent_time;
+
+    void backend_thread()
+    {
+        std::vector<uint8_t> data;
+
+        while (1) {
+            p_uart.recv(data);
+            sent.push_back(std::string(data.begin(), data.end()));
+            sent_time.push_back(sc_time_stamp());
+        }
+    }
+
+    void send(int count)
+    {
+        for (int i = 0; i < count; i++) {
+            tst.bus_write_u32(REG(UART_DR), 'a' + i);
+        }
+    }
+
+    /* Streaming access to UART_DR, as a DMA controller would do */
+    bool dr_stream(tlm::tlm_command cmd, uint8_t *data, unsigned int len,
+                   unsigned int width)
+    {
+        tlm::tlm_generic_payload trans;
+        sc_time delay = SC_ZERO_TIME;
+
+        trans.set_command(cmd);
+        trans.set_address(REG(UART_DR));
+        trans.set_data_ptr(data);
+        trans.set_data_length(len);
+        trans.set_streaming_width(width);
+        trans.set_byte_enable_ptr(nullptr);
+        trans.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+        tst.p_bus.socket->b_transport(trans, delay);
+
+        return trans.is_response_ok();
+    }
+
+    /* DMA request lines, as TX single, TX burst, RX single and RX burst
+     * bits. The lines are updated a delta cycle after the UART state. */
+    int dma_requests()
+    {
+        wait(1, SC_NS);
+
+        return (p_tx_dma_sreq.sc_p.read() << 3) | (p_tx_dma_breq.sc_p.read() << 2)
+            | (p_rx_dma_sreq.sc_p.read() << 1) | p_rx_dma_breq.sc_p.read();
+    }
+
+    uint32_t ris() { return tst.bus_read_u32(REG(UART_RIS)); }
+    uint32_t mis() { return tst.bus_read_u32(REG(UART_MIS)); }
+
+public:
+    SC_HAS_PROCESS(Pl011Tester);
+
+    Pl011Tester(sc_module_name n, ConfigManager &c, const std::string &extra_yml = "")
+        : TestBench(n, c), tst("slave-tester", c), p_uart("uart")
+        , p_tx_dma_sreq("tx-dma-sreq"), p_tx_dma_breq("tx-dma-breq")
+        , p_rx_dma_sreq("rx-dma-sreq"), p_rx_dma_breq("rx-dma-breq")
+    {
+        std::stringstream yml;
+
+        yml << "fifo-depth: " << FIFO_DEPTH << "\n";
+        yml << "rx-timeout: 1 us\n";
+        yml << "tx-buffer-size: " << TX_BUFFER_SIZE << "\n";
+        yml << "tx-flush-timeout: 2 us\n";
+        yml << extra_yml;
+
+        uart = create_component_by_implem("uart-pl011", yml.str());
+        uart->get_port("mem").connect(tst.get_port("mem"));
+        uart->get_port("uart").connect(p_uart);
+        uart->get_port("tx-dma-sreq").connect(p_tx_dma_sreq);
+        uart->get_port("tx-dma-breq").connect(p_tx_dma_breq);
+        uart->get_port("rx-dma-sreq").connect(p_rx_dma_sreq);
+        uart->get_port("rx-dma-breq").connect(p_rx_dma_breq);
+
+        SC_THREAD(backend_thread);
+    }
+
+    void setup(bool loopback = true)
+    {
+        /* 8 bits, FIFOs enabled */
+        tst.bus_write_u32(REG(UART_LCRH), (0x3 << 5) | UART_LCRH_FEN);
+        tst.bus_write_u32(REG(UART_IFLS), (2 << 3) | 2);
+
+        /* UARTEN, TXE, RXE and loopback */
+        tst.bus_write_u32(REG(UART_CR), (1 << 9) | (1 << 8) | (loopback << 7) | 1);
+    }
+};
+
+RABBITS_UNIT_TESTBENCH(rx_trigger_level, Pl011Tester)
+{
+    setup();
+
+    /* The TX FIFO is empty, always below its trigger level */
+    RABBITS_TEST_ASSERT_EQ(ris(), UART_INT_TX);
+
+    send(RX_TRIGGER - 1);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RX, 0);
+
+    send(1);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RX, UART_INT_RX);
+
+    /* Characters come out in order */
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_DR)), 'a');
+
+    /* Below the trigger level again */
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RX, 0);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFE, 0);
+}
+
+RABBITS_UNIT_TESTBENCH(rx_timeout, Pl011Tester)
+{
+    setup();
+
+    send(3);
+    RABBITS_TEST_ASSERT_EQ(ris() & (UART_INT_RX | UART_INT_RT), 0);
+
+    wait(RX_TIMEOUT / 2);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RT, 0);
+
+    wait(RX_TIMEOUT);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RT, UART_INT_RT);
+
+    /* Cleared once the FIFO is empty */
+    for (int i = 0; i < 3; i++) {
+        tst.bus_read_u32(REG(UART_DR));
+    }
+
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RT, 0);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFE, UART_FR_RXFE);
+}
+
+RABBITS_UNIT_TESTBENCH(mask_and_clear, Pl011Tester)
+{
+    setup();
+
+    send(RX_TRIGGER);
+    RABBITS_TEST_ASSERT_EQ(ris(), UART_INT_TX | UART_INT_RX);
+
+    /* Nothing unmasked yet */
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_IMSC)), 0);
+    RABBITS_TEST_ASSERT_EQ(mis(), 0);
+
+    tst.bus_write_u32(REG(UART_IMSC), UART_INT_RX);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_IMSC)), UART_INT_RX);
+    RABBITS_TEST_ASSERT_EQ(mis(), UART_INT_RX);
+
+    /* Unmasking TX does not raise anything new, it was already pending */
+    tst.bus_write_u32(REG(UART_IMSC), UART_INT_RX | UART_INT_TX);
+    RABBITS_TEST_ASSERT_EQ(mis(), UART_INT_TX | UART_INT_RX);
+
+    /* ICR only clears the written bits */
+    tst.bus_write_u32(REG(UART_ICR), UART_INT_RX);
+    RABBITS_TEST_ASSERT_EQ(ris(), UART_INT_TX);
+    RABBITS_TEST_ASSERT_EQ(mis(), UART_INT_TX);
+
+    tst.bus_write_u32(REG(UART_ICR), UART_INT_ALL);
+    RABBITS_TEST_ASSERT_EQ(ris(), 0);
+    RABBITS_TEST_ASSERT_EQ(mis(), 0);
+}
+
+RABBITS_UNIT_TESTBENCH(rx_overrun, Pl011Tester)
+{
+    setup();
+
+    send(FIFO_DEPTH);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFF, UART_FR_RXFF);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_OE, 0);
+
+    /* The character is lost and the overrun reported */
+    send(1);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_OE, UART_INT_OE);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_RSRECR)) & UART_RSR_OE, UART_RSR_OE);
+
+    tst.bus_write_u32(REG(UART_ICR), UART_INT_OE);
+    tst.bus_write_u32(REG(UART_RSRECR), 0);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_OE, 0);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_RSRECR)), 0);
+}
+
+RABBITS_UNIT_TESTBENCH(dma_streaming, Pl011Tester)
+{
+    uint32_t beats[] = { 'w', 'x', 'y', 'z' };
+    uint8_t buf[8];
+
+    setup();
+
+    /* One character per 32 bits beat */
+    RABBITS_TEST_ASSERT(dr_stream(tlm::TLM_WRITE_COMMAND,
+                                  reinterpret_cast<uint8_t*>(beats),
+                                  sizeof(beats), sizeof(beats[0])));
+
+    /* Read back as 8 bits beats */
+    RABBITS_TEST_ASSERT(dr_stream(tlm::TLM_READ_COMMAND, buf, 4, 1));
+    RABBITS_TEST_ASSERT(std::memcmp(buf, "wxyz", 4) == 0);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFE, UART_FR_RXFE);
+
+    /* Not enough characters, the FIFO is left untouched */
+    send(2);
+    RABBITS_TEST_ASSERT(!dr_stream(tlm::TLM_READ_COMMAND, buf, 3, 1));
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_DR)), 'a');
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_DR)), 'b');
+
+    /* Partial beat */
+    RABBITS_TEST_ASSERT(!dr_stream(tlm::TLM_WRITE_COMMAND, buf, 6, 4));
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFE, UART_FR_RXFE);
+}
+
+const int TX_SREQ = 1 << 3, TX_BREQ = 1 << 2, RX_SREQ = 1 << 1, RX_BREQ = 1;
+
+RABBITS_UNIT_TESTBENCH(dma_request_lines, Pl011Tester)
+{
+    setup();
+
+    /* Nothing requested until enabled in UART_DMACR */
+    send(RX_TRIGGER);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), 0);
+
+    /* The TX FIFO is always empty in instant timing mode */
+    tst.bus_write_u32(REG(UART_DMACR), UART_DMACR_TXDMAE | UART_DMACR_RXDMAE);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ | RX_SREQ | RX_BREQ);
+
+    /* Below the RX trigger level, single requests only */
+    tst.bus_read_u32(REG(UART_DR));
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ | RX_SREQ);
+
+    for (int i = 1; i < RX_TRIGGER; i++) {
+        tst.bus_read_u32(REG(UART_DR));
+    }
+
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ);
+
+    /* With DMAONERR, a pending error masks the RX requests */
+    tst.bus_write_u32(REG(UART_DMACR), UART_DMACR_TXDMAE | UART_DMACR_RXDMAE
+                                       | UART_DMACR_DMAONERR);
+    send(FIFO_DEPTH + 1);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_OE, UART_INT_OE);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ);
+
+    tst.bus_write_u32(REG(UART_ICR), UART_INT_OE);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ | RX_SREQ | RX_BREQ);
+
+    tst.bus_write_u32(REG(UART_DMACR), 0);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), 0);
+}
+
+RABBITS_UNIT_TESTBENCH(tx_flush_newline, Pl011Tester)
+{
+    setup(false);
+
+    send(2);
+    wait(1, SC_NS);
+    RABBITS_TEST_ASSERT(sent.empty());
+
+    /* A newline sends the staged characters along with it */
+    tst.bus_write_u32(REG(UART_DR), '\n');
+    wait(1, SC_NS);
+    RABBITS_TEST_ASSERT_EQ(sent.size(), 1);
+    RABBITS_TEST_ASSERT_EQ(sent[0], "ab\n");
+}
+
+RABBITS_UNIT_TESTBENCH(tx_flush_size, Pl011Tester)
+{
+    setup(false);
+
+    send(TX_BUFFER_SIZE - 1);
+    wait(1, SC_NS);
+    RABBITS_TEST_ASSERT(sent.empty());
+
+    /* Sent as soon as the staging buffer is full */
+    tst.bus_write_u32(REG(UART_DR), 'x');
+    wait(1, SC_NS);
+    RABBITS_TEST_ASSERT_EQ(sent.size(), 1);
+    RABBITS_TEST_ASSERT_EQ(sent[0], "abcdefgx");
+
+    /* The next batch starts empty */
+    send(1);
+    wait(1, SC_NS);
+    RABBITS_TEST_ASSERT_EQ(sent.size(), 1);
+}
+
+RABBITS_UNIT_TESTBENCH(tx_flush_timeout, Pl011Tester)
+{
+    sc_time start;
+
+    setup(false);
+
+    start = sc_time_stamp();
+    send(2);
+
+    wait(TX_FLUSH_TIMEOUT / 2);
+    RABBITS_TEST_ASSERT(sent.empty());
+
+    /* The timeout runs from the first staged character */
+    send(1);
+    wait(TX_FLUSH_TIMEOUT);
+    RABBITS_TEST_ASSERT_EQ(sent.size(), 1);
+    RABBITS_TEST_ASSERT_EQ(sent[0], "aba");
+    RABBITS_TEST_ASSERT_EQ(sent_time[0], start + TX_FLUSH_TIMEOUT);
+}
+
+/* 16 MHz reference clock and a divisor of 1: 1 Mbaud, 10 bits per 8N1
+ * character */
+const sc_time CHAR_TIME(10, SC_US);
+
+class AccuratePl011Tester : public Pl011Tester {
+public:
+    AccuratePl011Tester(sc_module_name n, ConfigManager &c)
+        : Pl011Tester(n, c, "timing: accurate\n"
+                            "clock-frequency: 16000000\n")
+    {}
+
+    void setup(bool loopback = true)
+    {
+        tst.bus_write_u32(REG(UART_IBRD), 1);
+        tst.bus_write_u32(REG(UART_FBRD), 0);
+        Pl011Tester::setup(loopback);
+    }
+
+    uint32_t fr() { return tst.bus_read_u32(REG(UART_FR)); }
+};
+
+RABBITS_UNIT_TESTBENCH(tx_accurate_timing, AccuratePl011Tester)
+{
+    const int TX_TRIGGER = FIFO_DEPTH / 2;
+
+    setup(false);
+
+    RABBITS_TEST_ASSERT_EQ(fr() & (UART_FR_TXFE | UART_FR_BUSY), UART_FR_TXFE);
+
+    send(FIFO_DEPTH);
+    RABBITS_TEST_ASSERT_EQ(fr() & (UART_FR_TXFE | UART_FR_TXFF | UART_FR_BUSY),
+                           UART_FR_TXFF | UART_FR_BUSY);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_TX, 0);
+
+    /* One character leaves the FIFO every CHAR_TIME */
+    wait(CHAR_TIME / 2);
+    RABBITS_TEST_ASSERT_EQ(fr() & UART_FR_TXFF, UART_FR_TXFF);
+
+    wait(CHAR_TIME);
+    RABBITS_TEST_ASSERT_EQ(fr() & UART_FR_TXFF, 0);
+
+    /* Back to the trigger level once enough characters have been sent */
+    wait(CHAR_TIME * (FIFO_DEPTH - TX_TRIGGER - 2));
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_TX, 0);
+
+    wait(CHAR_TIME);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_TX, UART_INT_TX);
+
+    /* The transmitter is busy until the last character is out */
+    wait(CHAR_TIME * (TX_TRIGGER - 1));
+    RABBITS_TEST_ASSERT_EQ(fr() & (UART_FR_TXFE | UART_FR_BUSY), UART_FR_BUSY);
+
+    wait(CHAR_TIME);
+    RABBITS_TEST_ASSERT_EQ(fr() & (UART_FR_TXFE | UART_FR_BUSY), UART_FR_TXFE);
+
+    wait(TX_FLUSH_TIMEOUT);
+    RABBITS_TEST_ASSERT_EQ(sent.size(), 2);
+    RABBITS_TEST_ASSERT_EQ(sent[0] + sent[1], "abcdefghijklmnop");
+}
+
+RABBITS_UNIT_TESTBENCH(rx_accurate_timing, AccuratePl011Tester)
+{
+    setup();
+
+    /* Looped back characters arrive once they have been on the line */
+    send(1);
+    wait(CHAR_TIME / 2);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFE, UART_FR_RXFE);
+
+    wait(CHAR_TIME);
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(REG(UART_FR)) & UART_FR_RXFE, 0);
+
+    /* Receive timeout of 32 bit periods */
+    wait(sc_time(32 - 1, SC_US) - CHAR_TIME / 2);
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RT, 0);
+
+    wait(sc_time(2, SC_US));
+    RABBITS_TEST_ASSERT_EQ(ris() & UART_INT_RT, UART_INT_RT);
+}
+
+RABBITS_UNIT_TESTBENCH(dma_streaming_accurate, AccuratePl011Tester)
+{
+    const int COUNT = FIFO_DEPTH + 4;
+    uint32_t beats[COUNT];
+    std::string expected;
+    sc_time start;
+
+    setup(false);
+    tst.bus_write_u32(REG(UART_DMACR), UART_DMACR_TXDMAE);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ);
+
+    for (int i = 0; i < COUNT; i++) {
+        beats[i] = 'a' + i;
+        expected += char('a' + i);
+    }
+
+    /* Stalls until the transmitter makes room for the last characters */
+    start = sc_time_stamp();
+    RABBITS_TEST_ASSERT(dr_stream(tlm::TLM_WRITE_COMMAND,
+                                  reinterpret_cast<uint8_t*>(beats),
+                                  sizeof(beats), sizeof(beats[0])));
+    RABBITS_TEST_ASSERT_EQ(sc_time_stamp() - start, CHAR_TIME * (COUNT - FIFO_DEPTH));
+
+    /* Full, no request until an entry is free */
+    RABBITS_TEST_ASSERT_EQ(fr() & UART_FR_TXFF, UART_FR_TXFF);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), 0);
+
+    wait(CHAR_TIME);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ);
+
+    /* Nothing lost */
+    wait(CHAR_TIME * FIFO_DEPTH + TX_FLUSH_TIMEOUT);
+    RABBITS_TEST_ASSERT_EQ(dma_requests(), TX_SREQ | TX_BREQ);
+
+    std::string out;
+
+    for (unsigned int i = 0; i < sent.size(); i++) {
+        out += sent[i];
+    }
+
+    RABBITS_TEST_ASSERT_EQ(out, expected);
+}
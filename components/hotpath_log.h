@@ -0,0 +1,47 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _HOTPATH_LOG_H_
+#define _HOTPATH_LOG_H_
+
+#include <rabbits/logger.h>
+
+/*
+ * Logging for per-access paths (bus callbacks, interconnect transport).
+ *
+ * Messages above RABBITS_HOTPATH_LOG_LEVEL are compiled out, their arguments
+ * are never evaluated. The level is set at configure time through the
+ * RABBITS_HOTPATH_LOG_LEVEL CMake option. Enabled messages still go through
+ * the runtime logger filtering.
+ */
+#ifndef RABBITS_HOTPATH_LOG_LEVEL
+# define RABBITS_HOTPATH_LOG_LEVEL TRC
+#endif
+
+#define HOTPATH_LOG_ENABLED(lvl) \
+    (LogLevel::lvl <= LogLevel::RABBITS_HOTPATH_LOG_LEVEL)
+
+#define HOTPATH_MLOG_F(cx, lvl, ...)            \
+    do {                                        \
+        if (HOTPATH_LOG_ENABLED(lvl)) {         \
+            MLOG_F(cx, lvl, __VA_ARGS__);       \
+        }                                       \
+    } while (0)
+
+#endif
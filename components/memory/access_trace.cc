@@ -0,0 +1,144 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "access_trace.h"
+
+#include <chrono>
+#include <algorithm>
+
+const uint64_t AccessTrace::RING_SIZE;
+
+AccessTrace::AccessTrace()
+    : m_file(NULL)
+    , m_with_data(false)
+    , m_sampling(ACCESS_TRACE_SAMPLE_ALL)
+    , m_sampling_rate(1)
+    , m_countdown(1)
+    , m_rand(88172645463325252ull)
+    , m_window_period(0)
+    , m_window_length(0)
+    , m_window_end(0)
+    , m_period_end(0)
+    , m_head(0)
+    , m_tail(0)
+    , m_stop(false)
+    , m_stalls(0)
+{
+}
+
+AccessTrace::~AccessTrace()
+{
+    close();
+}
+
+void AccessTrace::set_sampling(AccessTraceSampling mode, uint64_t rate,
+                               uint64_t window_period, uint64_t window_length)
+{
+    m_sampling = mode;
+    m_sampling_rate = rate ? rate : 1;
+    m_window_period = window_period;
+    m_window_length = window_length;
+
+    if (mode == ACCESS_TRACE_SAMPLE_WINDOW && window_period == 0) {
+        m_sampling = ACCESS_TRACE_SAMPLE_ALL;
+    }
+
+    m_countdown = (m_sampling == ACCESS_TRACE_SAMPLE_ALL) ? 1 : next_gap();
+    m_window_end = m_period_end = 0;
+}
+
+bool AccessTrace::open(const std::string &fn, uint64_t time_resolution_fs, bool with_data)
+{
+    AccessTraceHeader hdr;
+
+    m_file = std::fopen(fn.c_str(), "w");
+
+    if (m_file == NULL) {
+        return false;
+    }
+
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, ACCESS_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = ACCESS_TRACE_VERSION;
+    hdr.record_size = sizeof(AccessTraceRecord);
+    hdr.time_resolution_fs = time_resolution_fs;
+    hdr.sampling = m_sampling;
+    hdr.sampling_rate = m_sampling_rate;
+    hdr.window_period = m_window_period;
+    hdr.window_length = m_window_length;
+
+    if (std::fwrite(&hdr, sizeof(hdr), 1, m_file) != 1) {
+        std::fclose(m_file);
+        m_file = NULL;
+        return false;
+    }
+
+    m_with_data = with_data;
+    m_ring.resize(RING_SIZE);
+    m_stop = false;
+    m_writer = std::thread(&AccessTrace::writer_thread, this);
+
+    return true;
+}
+
+void AccessTrace::close()
+{
+    if (m_file == NULL) {
+        return;
+    }
+
+    m_stop = true;
+    m_writer.join();
+
+    /* The producer is done, write what is left */
+    drain();
+
+    std::fclose(m_file);
+    m_file = NULL;
+}
+
+/* Write the records available in the ring, returns their count */
+uint64_t AccessTrace::drain()
+{
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t count = head - tail;
+
+    while (tail != head) {
+        /* Contiguous part of the ring */
+        uint64_t idx = tail & (RING_SIZE - 1);
+        uint64_t n = std::min(head - tail, RING_SIZE - idx);
+
+        std::fwrite(&m_ring[idx], sizeof(AccessTraceRecord), n, m_file);
+
+        tail += n;
+        m_tail.store(tail, std::memory_order_release);
+    }
+
+    return count;
+}
+
+void AccessTrace::writer_thread()
+{
+    while (!m_stop) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
@@ -0,0 +1,283 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _ACCESS_TRACE_H_
+#define _ACCESS_TRACE_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+/*
+ * Binary memory access trace file layout: an AccessTraceHeader, followed by
+ * fixed size AccessTraceRecords. Times are in units of the header time
+ * resolution. Fields are in host endianness.
+ *
+ * This header is shared with the offline decoder and must not depend on
+ * SystemC nor Rabbits.
+ */
+static const char ACCESS_TRACE_MAGIC[8] = { 'R', 'B', 'T', 'T', 'R', 'A', 'C', 'E' };
+static const uint32_t ACCESS_TRACE_VERSION = 2;
+
+enum AccessTraceSampling {
+    ACCESS_TRACE_SAMPLE_ALL,
+    ACCESS_TRACE_SAMPLE_EVERY_NTH, /* One access every sampling_rate */
+    ACCESS_TRACE_SAMPLE_RANDOM,    /* One access in sampling_rate on average */
+    ACCESS_TRACE_SAMPLE_WINDOW,    /* Accesses in [k * period, k * period + length) */
+};
+
+struct AccessTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t time_resolution_fs;
+    uint32_t sampling;
+    uint32_t reserved;
+    uint64_t sampling_rate;
+    uint64_t window_period;
+    uint64_t window_length;
+};
+
+struct AccessTraceRecord {
+    enum Flags {
+        WRITE = 1 << 0,
+        HAS_DATA = 1 << 1,
+    };
+
+    uint64_t time;
+    uint64_t addr;
+    uint32_t size;
+    uint32_t flags;
+    uint8_t data[8]; /* First bytes of the access, when HAS_DATA is set */
+};
+
+/*
+ * Sequential reader of a trace file, used by the offline decoder.
+ */
+class AccessTraceReader {
+protected:
+    FILE *m_file;
+    AccessTraceHeader m_hdr;
+
+public:
+    enum Status {
+        OK,
+        CANNOT_OPEN,
+        BAD_MAGIC,
+        BAD_VERSION,
+    };
+
+    AccessTraceReader() : m_file(NULL) { std::memset(&m_hdr, 0, sizeof(m_hdr)); }
+    ~AccessTraceReader() { close(); }
+
+    Status open(const std::string &fn)
+    {
+        close();
+
+        m_file = std::fopen(fn.c_str(), "r");
+
+        if (m_file == NULL) {
+            return CANNOT_OPEN;
+        }
+
+        if (std::fread(&m_hdr, sizeof(m_hdr), 1, m_file) != 1
+            || std::memcmp(m_hdr.magic, ACCESS_TRACE_MAGIC, sizeof(m_hdr.magic))) {
+            close();
+            return BAD_MAGIC;
+        }
+
+        if (m_hdr.version != ACCESS_TRACE_VERSION
+            || m_hdr.record_size != sizeof(AccessTraceRecord)) {
+            close();
+            return BAD_VERSION;
+        }
+
+        return OK;
+    }
+
+    void close()
+    {
+        if (m_file != NULL) {
+            std::fclose(m_file);
+            m_file = NULL;
+        }
+    }
+
+    const AccessTraceHeader & get_header() const { return m_hdr; }
+
+    bool read(AccessTraceRecord &r)
+    {
+        return std::fread(&r, sizeof(r), 1, m_file) == 1;
+    }
+
+    /* Factor from recorded to estimated accesses. Window sampled traces
+     * are not scaled, the share of time covered depends on the workload
+     * phases. */
+    uint64_t get_scale() const
+    {
+        if (m_hdr.sampling == ACCESS_TRACE_SAMPLE_EVERY_NTH
+            || m_hdr.sampling == ACCESS_TRACE_SAMPLE_RANDOM) {
+            return m_hdr.sampling_rate;
+        }
+
+        return 1;
+    }
+};
+
+/*
+ * Records are pushed by the simulation thread into a lock-free single
+ * producer, single consumer ring buffer, and written to the file in batches
+ * by a background thread.
+ */
+class AccessTrace {
+protected:
+    static const uint64_t RING_SIZE = 1 << 16; /* Records, power of two */
+
+    FILE *m_file;
+    bool m_with_data;
+
+    /* Sampling state, only touched by the producer */
+    AccessTraceSampling m_sampling;
+    uint64_t m_sampling_rate;
+    uint64_t m_countdown;
+    uint64_t m_rand;
+    uint64_t m_window_period;
+    uint64_t m_window_length;
+    uint64_t m_window_end;
+    uint64_t m_period_end;
+
+    std::vector<AccessTraceRecord> m_ring;
+
+    /* Producer and consumer indexes, padded so that they do not share a
+     * cache line */
+    std::atomic<uint64_t> m_head;
+    char m_head_pad[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> m_tail;
+    char m_tail_pad[64 - sizeof(std::atomic<uint64_t>)];
+
+    std::atomic<bool> m_stop;
+
+    std::thread m_writer;
+    uint64_t m_stalls;
+
+    void writer_thread();
+    uint64_t drain();
+
+    uint64_t next_gap()
+    {
+        if (m_sampling == ACCESS_TRACE_SAMPLE_EVERY_NTH) {
+            return m_sampling_rate;
+        }
+
+        /* Uniform in [1, 2 * rate - 1], of mean rate */
+        m_rand ^= m_rand << 13;
+        m_rand ^= m_rand >> 7;
+        m_rand ^= m_rand << 17;
+
+        return 1 + m_rand % (2 * m_sampling_rate - 1);
+    }
+
+    bool sample(uint64_t time)
+    {
+        switch (m_sampling) {
+        case ACCESS_TRACE_SAMPLE_ALL:
+            return true;
+
+        case ACCESS_TRACE_SAMPLE_EVERY_NTH:
+        case ACCESS_TRACE_SAMPLE_RANDOM:
+            if (--m_countdown) {
+                return false;
+            }
+
+            m_countdown = next_gap();
+            return true;
+
+        case ACCESS_TRACE_SAMPLE_WINDOW:
+            /* Only divide when entering a new period */
+            if (time >= m_period_end) {
+                uint64_t start = time - time % m_window_period;
+
+                m_window_end = start + m_window_length;
+                m_period_end = start + m_window_period;
+            }
+
+            return time < m_window_end;
+        }
+
+        return true;
+    }
+
+public:
+    AccessTrace();
+    virtual ~AccessTrace();
+
+    /* Must be called before open(). Window times are in time resolution
+     * units. */
+    void set_sampling(AccessTraceSampling mode, uint64_t rate,
+                      uint64_t window_period = 0, uint64_t window_length = 0);
+
+    bool open(const std::string &fn, uint64_t time_resolution_fs, bool with_data);
+    void close();
+
+    bool is_open() const { return m_file != NULL; }
+
+    /* Number of times the producer had to wait for the writer */
+    uint64_t get_stalls() const { return m_stalls; }
+
+    /* Record an access, if selected by the sampling mode */
+    void record(uint64_t time, uint64_t addr, const uint8_t *data,
+                uint32_t size, bool write)
+    {
+        if (!sample(time)) {
+            return;
+        }
+
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+
+        if (head - m_tail.load(std::memory_order_acquire) == RING_SIZE) {
+            /* Full, wait for the writer rather than losing records */
+            m_stalls++;
+
+            while (head - m_tail.load(std::memory_order_acquire) == RING_SIZE) {
+                std::this_thread::yield();
+            }
+        }
+
+        AccessTraceRecord &r = m_ring[head & (RING_SIZE - 1)];
+
+        r.time = time;
+        r.addr = addr;
+        r.size = size;
+        r.flags = write ? AccessTraceRecord::WRITE : 0;
+
+        if (m_with_data) {
+            r.flags |= AccessTraceRecord::HAS_DATA;
+            std::memset(r.data, 0, sizeof(r.data));
+            std::memcpy(r.data, data, size < sizeof(r.data) ? size : sizeof(r.data));
+        }
+
+        m_head.store(head + 1, std::memory_order_release);
+    }
+};
+
+#endif
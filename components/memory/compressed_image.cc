@@ -0,0 +1,351 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "compressed_image.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+static const char MAGIC[8] = { 'R', 'B', 'T', 'C', 'I', 'M', 'G', 0 };
+static const uint32_t VERSION = 1;
+
+enum ChunkType {
+    CHUNK_ZERO = 0,
+    CHUNK_DEFLATE = 1,
+    CHUNK_RAW = 2,
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_size;
+    uint64_t size;
+    uint64_t chunk_count;
+};
+
+struct ChunkEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t type;
+};
+
+const uint32_t CompressedImage::DEFAULT_CHUNK_SIZE;
+
+static bool is_zero(const uint8_t *data, uint64_t len)
+{
+    uint64_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, data + i, sizeof(w));
+
+        if (w) {
+            return false;
+        }
+    }
+
+    for (; i < len; i++) {
+        if (data[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool read_header(int fd, Header &hdr)
+{
+    if (::pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        return false;
+    }
+
+    return std::memcmp(hdr.magic, MAGIC, sizeof(hdr.magic)) == 0;
+}
+
+/* Check the chunk table against the header and the file size, so that
+ * workers never read past a chunk buffer or the memory */
+static bool check_table(const Header &hdr, const std::vector<ChunkEntry> &table,
+                        uint64_t file_size)
+{
+    for (uint64_t i = 0; i < table.size(); i++) {
+        const ChunkEntry &e = table[i];
+        uint64_t len = std::min(uint64_t(hdr.chunk_size), hdr.size - i * hdr.chunk_size);
+
+        switch (e.type) {
+        case CHUNK_ZERO:
+            continue;
+
+        case CHUNK_RAW:
+            if (e.length != len) {
+                return false;
+            }
+            break;
+
+        case CHUNK_DEFLATE:
+            if (e.length == 0) {
+                return false;
+            }
+            break;
+
+        default:
+            return false;
+        }
+
+        if (e.offset > file_size || e.length > file_size - e.offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool CompressedImage::is_compressed(const std::string &fn)
+{
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    Header hdr;
+    bool ret;
+
+    if (fd < 0) {
+        return false;
+    }
+
+    ret = read_header(fd, hdr);
+    ::close(fd);
+
+    return ret;
+}
+
+bool CompressedImage::get_size(const std::string &fn, uint64_t &size)
+{
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    Header hdr;
+    bool ret;
+
+    if (fd < 0) {
+        return false;
+    }
+
+    ret = read_header(fd, hdr);
+    ::close(fd);
+
+    if (ret) {
+        size = hdr.size;
+    }
+
+    return ret;
+}
+
+bool CompressedImage::save(const std::string &fn, const uint8_t *data, uint64_t size,
+                           uint32_t chunk_size)
+{
+    FILE *f = std::fopen(fn.c_str(), "w");
+    Header hdr;
+    bool ok;
+
+    if (f == NULL) {
+        return false;
+    }
+
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, MAGIC, sizeof(hdr.magic));
+    hdr.version = VERSION;
+    hdr.chunk_size = chunk_size;
+    hdr.size = size;
+    hdr.chunk_count = (size + chunk_size - 1) / chunk_size;
+
+    std::vector<ChunkEntry> table(hdr.chunk_count);
+    std::vector<uint8_t> buf(compressBound(chunk_size));
+    uint64_t offset = sizeof(hdr) + hdr.chunk_count * sizeof(ChunkEntry);
+
+    ok = (std::fseek(f, offset, SEEK_SET) == 0);
+
+    for (uint64_t i = 0; ok && i < hdr.chunk_count; i++) {
+        const uint8_t *chunk = data + i * chunk_size;
+        uint64_t len = std::min(uint64_t(chunk_size), size - i * chunk_size);
+        ChunkEntry &e = table[i];
+
+        e.offset = offset;
+
+        if (is_zero(chunk, len)) {
+            e.type = CHUNK_ZERO;
+            e.length = 0;
+            continue;
+        }
+
+        uLongf clen = buf.size();
+
+        if (compress2(&buf[0], &clen, chunk, len, Z_BEST_SPEED) == Z_OK && clen < len) {
+            e.type = CHUNK_DEFLATE;
+            e.length = clen;
+            ok = (std::fwrite(&buf[0], clen, 1, f) == 1);
+        } else {
+            e.type = CHUNK_RAW;
+            e.length = len;
+            ok = (std::fwrite(chunk, len, 1, f) == 1);
+        }
+
+        offset += e.length;
+    }
+
+    /* Header and chunk table go last, once chunk locations are known */
+    ok = ok && (std::fseek(f, 0, SEEK_SET) == 0);
+    ok = ok && (std::fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    ok = ok && (table.empty()
+                || std::fwrite(&table[0], sizeof(ChunkEntry), table.size(), f) == table.size());
+    ok = (std::fclose(f) == 0) && ok;
+
+    return ok;
+}
+
+bool CompressedImage::load(const std::string &fn, uint8_t *data, uint64_t size,
+                           bool zeroed, uint64_t &loaded,
+                           const std::atomic<bool> *abort)
+{
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    struct stat st;
+    Header hdr;
+
+    loaded = 0;
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (::fstat(fd, &st) < 0 || !read_header(fd, hdr)
+        || hdr.version != VERSION || hdr.chunk_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    /* The table must match the image size and fit in the file, which also
+     * bounds its allocation */
+    uint64_t file_size = st.st_size;
+    uint64_t expected_count = hdr.size / hdr.chunk_size + (hdr.size % hdr.chunk_size != 0);
+
+    if (hdr.chunk_count != expected_count
+        || hdr.chunk_count > (file_size - sizeof(hdr)) / sizeof(ChunkEntry)) {
+        ::close(fd);
+        return false;
+    }
+
+    std::vector<ChunkEntry> table(hdr.chunk_count);
+    ssize_t table_size = hdr.chunk_count * sizeof(ChunkEntry);
+
+    if (table_size && ::pread(fd, &table[0], table_size, sizeof(hdr)) != table_size) {
+        ::close(fd);
+        return false;
+    }
+
+    if (!check_table(hdr, table, file_size)) {
+        ::close(fd);
+        return false;
+    }
+
+    loaded = std::min(hdr.size, size);
+    uint64_t chunk_count = (loaded + hdr.chunk_size - 1) / hdr.chunk_size;
+
+    /* Chunks are independent, decompress them in parallel */
+    std::atomic<uint64_t> next(0);
+    std::atomic<bool> ok(true);
+
+    auto worker = [&] () {
+        std::vector<uint8_t> in;
+        std::vector<uint8_t> out;
+
+        for (uint64_t i = next++; ok && i < chunk_count; i = next++) {
+            const ChunkEntry &e = table[i];
+
+            if (abort != nullptr && *abort) {
+                ok = false;
+                break;
+            }
+
+            uint64_t ofs = i * hdr.chunk_size;
+            uint64_t len = std::min(uint64_t(hdr.chunk_size), hdr.size - ofs);
+            uint64_t to_copy = std::min(len, loaded - ofs);
+
+            if (e.type == CHUNK_ZERO) {
+                if (!zeroed) {
+                    std::memset(data + ofs, 0, to_copy);
+                }
+                continue;
+            }
+
+            in.resize(e.length);
+
+            if (::pread(fd, &in[0], e.length, e.offset) != ssize_t(e.length)) {
+                ok = false;
+                break;
+            }
+
+            if (e.type == CHUNK_RAW) {
+                std::memcpy(data + ofs, &in[0], to_copy);
+                continue;
+            }
+
+            /* Decompress in place, unless the chunk gets truncated */
+            uint8_t *dst = data + ofs;
+
+            if (to_copy < len) {
+                out.resize(len);
+                dst = &out[0];
+            }
+
+            uLongf dlen = len;
+
+            if (uncompress(dst, &dlen, &in[0], e.length) != Z_OK || dlen != len) {
+                ok = false;
+                break;
+            }
+
+            if (dst != data + ofs) {
+                std::memcpy(data + ofs, dst, to_copy);
+            }
+        }
+    };
+
+    unsigned int nthreads = std::max(1u, std::thread::hardware_concurrency());
+    nthreads = std::min(uint64_t(nthreads), std::max(uint64_t(1), chunk_count));
+
+    std::vector<std::thread> threads;
+
+    for (unsigned int i = 1; i < nthreads; i++) {
+        threads.push_back(std::thread(worker));
+    }
+
+    worker();
+
+    for (auto &t: threads) {
+        t.join();
+    }
+
+    ::close(fd);
+
+    return ok;
+}
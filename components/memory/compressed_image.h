@@ -0,0 +1,64 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _COMPRESSED_IMAGE_H_
+#define _COMPRESSED_IMAGE_H_
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+/*
+ * Chunked, compressed memory image.
+ *
+ * The image is split in fixed size chunks. Each chunk is either fully zero
+ * (and takes no space in the file), deflate compressed, or stored raw when
+ * compression does not help. A chunk table following the header gives the
+ * location of each chunk, so that chunks can be decompressed independently
+ * and in parallel. Fields are in host endianness.
+ *
+ * Nothing is logged here, errors are reported to the caller, which may be
+ * running on a host thread.
+ */
+class CompressedImage {
+public:
+    static const uint32_t DEFAULT_CHUNK_SIZE = 1 << 20;
+
+    /* Return true if fn starts with the compressed image magic */
+    static bool is_compressed(const std::string &fn);
+
+    /* Uncompressed size of the image */
+    static bool get_size(const std::string &fn, uint64_t &size);
+
+    static bool save(const std::string &fn, const uint8_t *data, uint64_t size,
+                     uint32_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    /*
+     * Load the image into data, truncating it to size bytes. When zeroed is
+     * true, data is known to be zero-filled already and zero chunks are not
+     * written at all, which keeps the corresponding pages untouched.
+     * loaded is set to the number of bytes covered by the image. Loading
+     * stops early, and fails, once abort gets set.
+     */
+    static bool load(const std::string &fn, uint8_t *data, uint64_t size,
+                     bool zeroed, uint64_t &loaded,
+                     const std::atomic<bool> *abort = nullptr);
+};
+
+#endif
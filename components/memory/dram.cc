@@ -0,0 +1,166 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "dram.h"
+
+#include <rabbits/logger.h>
+
+using namespace sc_core;
+
+/*
+ * Build the generic memory parameters from the DRAM ones, the same way the
+ * stub does, so that the storage related parameters are shared. The DRAM
+ * parameters are returned as is when the memory component cannot be found,
+ * which the constructor reports once the module (and its logger) exists.
+ */
+static Parameters memory_params(const Parameters &params, ConfigManager &c)
+{
+    ComponentManager::Factory f;
+    Parameters mem_params;
+
+    f = c.get_component_manager().find_by_type("memory");
+
+    if (f == nullptr) {
+        return params;
+    }
+
+    mem_params = f->get_params();
+
+    Parameters p = params;
+    mem_params.fill_from_description(p.get_base_description());
+
+    /* DRAM timings are exact unless averaged DMI is explicitly requested */
+    mem_params["disable-dmi"].set(!params["averaged-dmi"].as<bool>());
+
+    return mem_params;
+}
+
+Dram::Dram(sc_core::sc_module_name name, const Parameters &params, ConfigManager &c)
+    : Memory(name, memory_params(params, c), c)
+    , m_accesses(0)
+{
+    uint32_t banks = params["banks"].as<uint32_t>();
+
+    if (c.get_component_manager().find_by_type("memory") == nullptr) {
+        MLOG(APP, ERR) << "Unable to find memory component. Please check your Rabbits installation.\n";
+    }
+
+    m_row_size = params["row-size"].as<uint64_t>();
+    m_trcd = params["trcd"].as<sc_time>();
+    m_tcas = params["tcas"].as<sc_time>();
+    m_trp = params["trp"].as<sc_time>();
+
+    if (banks == 0) {
+        MLOG(APP, WRN) << "Invalid bank count. Falling back to 1.\n";
+        banks = 1;
+    }
+
+    if (m_row_size == 0) {
+        MLOG(APP, WRN) << "Invalid row size. Falling back to 1024.\n";
+        m_row_size = 1024;
+    }
+
+    m_banks.resize(banks);
+
+    std::string page_policy = params["page-policy"].as<std::string>();
+
+    if (page_policy == "open") {
+        m_page_policy = PAGE_OPEN;
+    } else if (page_policy == "closed") {
+        m_page_policy = PAGE_CLOSED;
+    } else {
+        MLOG(APP, WRN) << "Unknown page policy `" << page_policy << "`. Falling back to open.\n";
+        m_page_policy = PAGE_OPEN;
+    }
+}
+
+Dram::~Dram()
+{
+}
+
+sc_time Dram::row_access(uint64_t row)
+{
+    Bank &bank = m_banks[row % m_banks.size()];
+    uint64_t bank_row = row / m_banks.size();
+
+    if (m_page_policy == PAGE_CLOSED) {
+        /* The row is activated then precharged again on every access */
+        bank.stats.misses++;
+        return m_trcd + m_tcas + m_trp;
+    }
+
+    if (!bank.row_open) {
+        bank.stats.misses++;
+        bank.row_open = true;
+        bank.open_row = bank_row;
+        return m_trcd + m_tcas;
+    }
+
+    if (bank.open_row == bank_row) {
+        bank.stats.hits++;
+        return m_tcas;
+    }
+
+    bank.stats.conflicts++;
+    bank.open_row = bank_row;
+    return m_trp + m_trcd + m_tcas;
+}
+
+sc_time Dram::access_latency(const tlm::tlm_generic_payload &trans)
+{
+    uint64_t addr = trans.get_address();
+    unsigned int len = trans.get_data_length();
+    sc_time lat = SC_ZERO_TIME;
+
+    if (len == 0 || (!trans.is_read() && !trans.is_write())) {
+        return SC_ZERO_TIME;
+    }
+
+    /* A burst crossing a row boundary pays for each row it touches */
+    for (uint64_t row = addr / m_row_size; row <= (addr + len - 1) / m_row_size; row++) {
+        lat += row_access(row);
+    }
+
+    m_total_latency += lat;
+    m_accesses++;
+
+    return lat;
+}
+
+sc_time Dram::dmi_latency(tlm::tlm_command cmd) const
+{
+    /* Averaged over the accesses seen so far, before DMI takes over */
+    if (m_accesses == 0) {
+        return m_trcd + m_tcas;
+    }
+
+    return m_total_latency / double(m_accesses);
+}
+
+void Dram::end_of_simulation()
+{
+    Memory::end_of_simulation();
+
+    for (unsigned int i = 0; i < m_banks.size(); i++) {
+        const BankStats &s = m_banks[i].stats;
+
+        MLOG(APP, INF) << "bank " << i << ": " << s.hits << " hits, "
+            << s.misses << " misses, " << s.conflicts << " conflicts\n";
+    }
+}
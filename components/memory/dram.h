@@ -0,0 +1,84 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _DRAM_DEVICE_H_
+#define _DRAM_DEVICE_H_
+
+#include <vector>
+
+#include "memory.h"
+
+/*
+ * Memory with a banked DRAM timing model. Rows are interleaved across the
+ * banks, each bank keeping track of its open row. Storage, blobs and
+ * snapshots are handled by the generic memory.
+ */
+class Dram: public Memory
+{
+public:
+    struct BankStats {
+        uint64_t hits;      /* Access to the open row */
+        uint64_t misses;    /* Access to a precharged bank */
+        uint64_t conflicts; /* Access to another row than the open one */
+
+        BankStats() : hits(0), misses(0), conflicts(0) {}
+    };
+
+protected:
+    enum PagePolicy {
+        PAGE_OPEN,   /* Rows are left open after an access */
+        PAGE_CLOSED, /* Rows are precharged after each access */
+    };
+
+    struct Bank {
+        bool row_open;
+        uint64_t open_row;
+        BankStats stats;
+
+        Bank() : row_open(false), open_row(0) {}
+    };
+
+    PagePolicy m_page_policy;
+    uint64_t m_row_size;
+    std::vector<Bank> m_banks;
+
+    sc_core::sc_time m_trcd;
+    sc_core::sc_time m_tcas;
+    sc_core::sc_time m_trp;
+
+    /* Sum of the latencies charged so far, used for DMI */
+    sc_core::sc_time m_total_latency;
+    uint64_t m_accesses;
+
+    sc_core::sc_time row_access(uint64_t row);
+
+    virtual sc_core::sc_time access_latency(const tlm::tlm_generic_payload &trans);
+    virtual sc_core::sc_time dmi_latency(tlm::tlm_command cmd) const;
+
+public:
+    Dram(sc_core::sc_module_name name, const Parameters &params, ConfigManager &c);
+    virtual ~Dram();
+
+    unsigned int get_bank_count() const { return m_banks.size(); }
+    const BankStats & get_bank_stats(unsigned int bank) const { return m_banks[bank].stats; }
+
+    void end_of_simulation();
+};
+
+#endif
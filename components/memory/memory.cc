@@ -18,89 +18,1314 @@
  */
 
 #include "memory.h"
+#include "compressed_image.h"
+#include "hotpath_log.h"
+#include "temporal_decoupling.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <new>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <rabbits/logger.h>
 
-using namespace sc_core;
+using namespace sc_core;
+
+/* Access size assumed when reporting DMI latencies */
+static const unsigned int DMI_ACCESS_SIZE = 4;
+
+/* Raw blobs are streamed in chunks of this size */
+static const uint64_t BLOB_CHUNK_SIZE = 4 << 20;
+
+/*
+ * Snapshot file layout: a fixed header, then the raw memory content starting
+ * at SNAPSHOT_DATA_OFFSET. The data offset is page aligned so that the
+ * content can be mapped directly. Fields are in host endianness.
+ */
+static const char SNAPSHOT_MAGIC[8] = { 'R', 'B', 'T', 'S', 'N', 'A', 'P', 0 };
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint64_t SNAPSHOT_DATA_OFFSET = 4096;
+static const uint64_t SNAPSHOT_CHUNK_SIZE = 1 << 20;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t data_offset;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+/*
+ * Incremental snapshot layout: a fixed header, then page_count records made of
+ * a 64 bits page index followed by the page content. The checksum covers the
+ * records.
+ */
+static const char INCR_SNAPSHOT_MAGIC[8] = { 'R', 'B', 'T', 'I', 'N', 'C', 'R', 0 };
+
+struct IncrSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t size;
+    uint64_t page_count;
+    uint64_t checksum;
+};
+
+const uint64_t Memory::DIRTY_PAGE_SIZE;
+const uint64_t Memory::DIRTY_DMI_BLOCK_PAGES;
+
+static const uint64_t CHECKSUM_INIT = 0xcbf29ce484222325ull;
+
+/* FNV-1a, on 64 bits words for speed */
+static uint64_t checksum_update(uint64_t h, const uint8_t *data, uint64_t len)
+{
+    static const uint64_t PRIME = 0x100000001b3ull;
+    uint64_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, data + i, sizeof(w));
+        h = (h ^ w) * PRIME;
+    }
+
+    for (; i < len; i++) {
+        h = (h ^ data[i]) * PRIME;
+    }
+
+    return h;
+}
+
+Memory::Memory(sc_core::sc_module_name name, const Parameters &params, ConfigManager &c)
+    : Slave(name, params, c)
+{
+    MEM_WRITE_LATENCY = params["write-latency"].as<sc_time>();
+    MEM_READ_LATENCY = params["read-latency"].as<sc_time>();
+    MEM_WRITE_LATENCY_PER_BYTE = params["write-latency-per-byte"].as<sc_time>();
+    MEM_READ_LATENCY_PER_BYTE = params["read-latency-per-byte"].as<sc_time>();
+
+    m_size = params["size"].as<uint64_t>();
+    m_readonly = params["readonly"].as<bool>();
+    m_dmi = !params["disable-dmi"].as<bool>();
+    parse_dmi_windows(params["dmi-exclude"].as<std::string>(), false);
+    parse_dmi_windows(params["dmi-readonly"].as<std::string>(), true);
+    parse_watchpoints(params["watchpoints"].as<std::string>());
+    m_trace = NULL;
+    m_temporal_decoupling = params["temporal-decoupling"].as<bool>();
+
+    if (m_temporal_decoupling) {
+        sc_time quantum = params["global-quantum"].as<sc_time>();
+        bool conflict;
+
+        if (!setup_global_quantum(quantum, conflict)) {
+            MLOG(APP, WRN) << "Temporal decoupling enabled with a zero global quantum, "
+                "the memory will synchronize on every access\n";
+        } else if (conflict) {
+            MLOG(APP, WRN) << "Global quantum already set to "
+                << tlm::tlm_global_quantum::instance().get()
+                << " by another component, ignoring " << quantum << "\n";
+        }
+    }
+
+    m_bytes = NULL;
+    m_mapping_size = 0;
+    m_blob_abort = false;
+
+    m_dirty_tracking = params["dirty-tracking"].as<bool>();
+    m_checkpoint_period = params["checkpoint-period"].as<sc_time>();
+    m_checkpoint_prefix = params["checkpoint-prefix"].as<std::string>();
+
+    if (m_checkpoint_period != SC_ZERO_TIME) {
+        if (m_checkpoint_prefix == "") {
+            MLOG(APP, ERR) << "Periodic checkpoints require a `checkpoint-prefix`\n";
+        } else {
+            m_dirty_tracking = true;
+            SC_THREAD(checkpoint_thread);
+        }
+    }
+
+    if (m_dirty_tracking) {
+        uint64_t pages = (m_size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+        m_dirty.resize((pages + 63) / 64, 0);
+    }
+
+    std::string storage = params["storage"].as<std::string>();
+
+    if (storage == "heap") {
+        m_storage = STORAGE_HEAP;
+    } else if (storage == "file-shared") {
+        m_storage = STORAGE_FILE_SHARED;
+    } else if (storage == "file-private") {
+        m_storage = STORAGE_FILE_PRIVATE;
+    } else if (storage == "sparse") {
+        m_storage = STORAGE_SPARSE;
+    } else if (storage == "snapshot-private") {
+        m_storage = STORAGE_SNAPSHOT_PRIVATE;
+    } else {
+        MLOG(APP, WRN) << "Unknown storage `" << storage << "`. Falling back to heap.\n";
+        m_storage = STORAGE_HEAP;
+    }
+
+    std::string huge_pages = params["huge-pages"].as<std::string>();
+
+    if (huge_pages == "none") {
+        m_huge_pages = HUGE_PAGES_NONE;
+    } else if (huge_pages == "transparent") {
+        m_huge_pages = HUGE_PAGES_TRANSPARENT;
+    } else if (huge_pages == "hugetlbfs") {
+        m_huge_pages = HUGE_PAGES_HUGETLBFS;
+    } else {
+        MLOG(APP, WRN) << "Unknown huge-pages mode `" << huge_pages << "`. Falling back to none.\n";
+        m_huge_pages = HUGE_PAGES_NONE;
+    }
+
+    std::string snapshot_fn = params["snapshot-restore"].as<std::string>();
+
+    alloc_storage(params["file-blob"].as<std::string>(), snapshot_fn);
+
+    /* In snapshot-private storage, the snapshot is the storage itself */
+    if (snapshot_fn != "" && m_storage != STORAGE_SNAPSHOT_PRIVATE) {
+        restore_snapshot(snapshot_fn);
+    }
+
+    m_snapshot_save = params["snapshot-save"].as<std::string>();
+    m_snapshot_compression = params["snapshot-compression"].as<bool>();
+
+    std::string trace_fn = params["trace-file"].as<std::string>();
+
+    if (trace_fn != "") {
+        uint64_t resolution_fs = sc_get_time_resolution().to_seconds() * 1e15 + 0.5;
+
+        m_trace = new AccessTrace;
+        m_trace->set_sampling(parse_trace_sampling(params["trace-sampling"].as<std::string>()),
+                              params["trace-sampling-rate"].as<uint64_t>(),
+                              params["trace-window-period"].as<sc_time>().value(),
+                              params["trace-window-length"].as<sc_time>().value());
+
+        if (!m_trace->open(trace_fn, resolution_fs, params["trace-data"].as<bool>())) {
+            MLOG(APP, ERR) << "Cannot open trace file " << trace_fn << "\n";
+            delete m_trace;
+            m_trace = NULL;
+        }
+    }
+}
+
+
+AccessTraceSampling Memory::parse_trace_sampling(const std::string &mode)
+{
+    if (mode == "all") {
+        return ACCESS_TRACE_SAMPLE_ALL;
+    } else if (mode == "every-nth") {
+        return ACCESS_TRACE_SAMPLE_EVERY_NTH;
+    } else if (mode == "random") {
+        return ACCESS_TRACE_SAMPLE_RANDOM;
+    } else if (mode == "window") {
+        return ACCESS_TRACE_SAMPLE_WINDOW;
+    }
+
+    MLOG(APP, WRN) << "Unknown trace sampling `" << mode << "`. Falling back to all.\n";
+    return ACCESS_TRACE_SAMPLE_ALL;
+}
+
+Memory::~Memory()
+{
+    m_blob_abort = true;
+
+    if (m_blob_loader.joinable()) {
+        m_blob_loader.join();
+    }
+
+    delete m_trace;
+    free_storage();
+}
+
+bool Memory::map_file(const std::string &fn, bool shared)
+{
+    int fd = ::open(fn.c_str(), shared ? O_RDWR : O_RDONLY);
+    struct stat st;
+    void *p;
+
+    MLOG(APP, DBG) << "Mapping file `" << fn << "`" << (shared ? " (shared)" : " (private)") << "\n";
+
+    if (fd < 0) {
+        MLOG(APP, ERR) << "Cannot open file " << fn << "\n";
+        return false;
+    }
+
+    if (::fstat(fd, &st) < 0) {
+        MLOG(APP, ERR) << "Cannot stat file " << fn << "\n";
+        ::close(fd);
+        return false;
+    }
+
+    uint64_t file_size = st.st_size;
+
+    if (file_size > m_size) {
+        MLOG(APP, WRN) << "File `" << fn << "` does not fit into memory, mapping will be truncated\n";
+    }
+
+    if (shared) {
+        /* Accesses past the end of a shared file mapping are not allowed */
+        if (file_size < m_size) {
+            MLOG(APP, WRN) << "Extending file `" << fn << "` to the memory size\n";
+
+            if (::ftruncate(fd, m_size) < 0) {
+                MLOG(APP, ERR) << "Cannot extend file " << fn << "\n";
+                ::close(fd);
+                return false;
+            }
+        }
+
+        p = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        /* Anonymous zeroed mapping for the whole memory, with the file
+         * mapped over its beginning */
+        p = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        uint64_t to_map = std::min(file_size, m_size);
+
+        if (p != MAP_FAILED && to_map) {
+            void *f = ::mmap(p, to_map, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_FIXED, fd, 0);
+
+            if (f == MAP_FAILED) {
+                ::munmap(p, m_size);
+                p = MAP_FAILED;
+            }
+        }
+    }
+
+    ::close(fd);
+
+    if (p == MAP_FAILED) {
+        MLOG(APP, ERR) << "Cannot map file " << fn << "\n";
+        return false;
+    }
+
+    m_bytes = static_cast<uint8_t*>(p);
+    m_mapping_size = m_size;
+    return true;
+}
+
+bool Memory::map_anonymous(bool noreserve)
+{
+    static const uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /* Untouched pages of an anonymous mapping are backed by the zero page:
+     * reading them returns zeros and does not allocate host memory. Only
+     * written pages get allocated. */
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *p = MAP_FAILED;
+
+    if (noreserve) {
+        flags |= MAP_NORESERVE;
+    }
+
+    if (m_huge_pages == HUGE_PAGES_HUGETLBFS) {
+        m_mapping_size = (m_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        p = ::mmap(NULL, m_mapping_size, PROT_READ | PROT_WRITE,
+                   (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+
+        if (p != MAP_FAILED) {
+            m_bytes = static_cast<uint8_t*>(p);
+            return true;
+        }
+
+        MLOG(APP, WRN) << "Cannot allocate memory from hugetlbfs, "
+            "check /proc/sys/vm/nr_hugepages. Falling back to transparent huge pages.\n";
+        m_huge_pages = HUGE_PAGES_TRANSPARENT;
+    }
+
+    if (m_huge_pages == HUGE_PAGES_TRANSPARENT) {
+        /* Over-allocate so that the buffer can be aligned on a huge page
+         * boundary, then give back the unused head and tail */
+        uint64_t len = m_size + HUGE_PAGE_SIZE;
+        p = ::mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+        if (p != MAP_FAILED) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(p);
+            uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            uintptr_t end = start + len;
+            uintptr_t aligned_end = aligned + ((m_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+
+            if (aligned_end > end) {
+                aligned_end = end;
+            }
+
+            if (aligned > start) {
+                ::munmap(p, aligned - start);
+            }
+
+            if (end > aligned_end) {
+                ::munmap(reinterpret_cast<void*>(aligned_end), end - aligned_end);
+            }
+
+            p = reinterpret_cast<void*>(aligned);
+            m_mapping_size = aligned_end - aligned;
+
+            if (::madvise(p, m_mapping_size, MADV_HUGEPAGE) < 0) {
+                MLOG(APP, WRN) << "Transparent huge pages are not available\n";
+            }
+        }
+    } else {
+        m_mapping_size = m_size;
+        p = ::mmap(NULL, m_mapping_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+
+    if (p == MAP_FAILED) {
+        MLOG(APP, ERR) << "Cannot reserve " << m_size << " bytes of address space\n";
+        return false;
+    }
+
+    m_bytes = static_cast<uint8_t*>(p);
+    return true;
+}
+
+bool Memory::map_snapshot(const std::string &fn)
+{
+    FILE *f = std::fopen(fn.c_str(), "r");
+    void *p;
+
+    MLOG(APP, DBG) << "Mapping snapshot `" << fn << "` copy-on-write\n";
+
+    if (f == NULL) {
+        MLOG(APP, ERR) << "Cannot open snapshot file " << fn << "\n";
+        return false;
+    }
+
+    if (!read_snapshot_header(f, fn)) {
+        std::fclose(f);
+        return false;
+    }
+
+    if (m_snapshot_data_offset % ::sysconf(_SC_PAGESIZE)) {
+        MLOG(APP, ERR) << "Snapshot " << fn << " content is not page aligned, cannot map it\n";
+        std::fclose(f);
+        return false;
+    }
+
+    /* The header check guarantees the file covers the whole mapping,
+     * accessing it past the end of the file would raise SIGBUS.
+     *
+     * Pages are read lazily from the page cache, which is shared by all the
+     * processes mapping the same snapshot. A process only pays for the pages
+     * it writes to. The checksum is not verified since it would require
+     * reading the whole content. */
+    p = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE,
+               fileno(f), m_snapshot_data_offset);
+
+    std::fclose(f);
+
+    if (p == MAP_FAILED) {
+        MLOG(APP, ERR) << "Cannot map snapshot " << fn << "\n";
+        return false;
+    }
+
+    m_bytes = static_cast<uint8_t*>(p);
+    m_mapping_size = m_size;
+    return true;
+}
+
+void Memory::alloc_storage(const std::string &blob_fn, const std::string &snapshot_fn)
+{
+    bool ok = false;
+
+    switch (m_storage) {
+    case STORAGE_SNAPSHOT_PRIVATE:
+        if (snapshot_fn == "") {
+            MLOG(APP, ERR) << "Snapshot storage requires a `snapshot-restore`.\n";
+            break;
+        }
+
+        if (CompressedImage::is_compressed(snapshot_fn)) {
+            /* Same as compressed blobs, restored in a sparse mapping */
+            MLOG(APP, WRN) << "`" << snapshot_fn << "` is compressed, using sparse storage.\n";
+            m_storage = STORAGE_SPARSE;
+            ok = map_anonymous(true);
+            break;
+        }
+
+        if (map_snapshot(snapshot_fn)) {
+            return;
+        }
+        break;
+
+    case STORAGE_FILE_SHARED:
+    case STORAGE_FILE_PRIVATE:
+        if (blob_fn == "") {
+            MLOG(APP, ERR) << "File storage requires a `file-blob`.\n";
+            break;
+        }
+
+        if (CompressedImage::is_compressed(blob_fn)) {
+            /* A compressed blob cannot be mapped, decompress it in a
+             * sparse mapping instead */
+            MLOG(APP, WRN) << "`" << blob_fn << "` is compressed, using sparse storage.\n";
+            m_storage = STORAGE_SPARSE;
+            ok = map_anonymous(true);
+            break;
+        }
+
+        /* The blob is the storage itself, nothing to load */
+        if (map_file(blob_fn, m_storage == STORAGE_FILE_SHARED)) {
+            return;
+        }
+        break;
+
+    case STORAGE_SPARSE:
+        ok = map_anonymous(true);
+        break;
+
+    case STORAGE_HEAP:
+        if (m_huge_pages == HUGE_PAGES_NONE) {
+            ok = true;
+        } else if ((ok = map_anonymous(false))) {
+            m_storage = STORAGE_ANONYMOUS;
+        }
+        break;
+
+    case STORAGE_ANONYMOUS:
+        ok = map_anonymous(false);
+        break;
+    }
+
+    if (!ok) {
+        MLOG(APP, ERR) << "Falling back to heap storage.\n";
+        m_storage = STORAGE_HEAP;
+    }
+
+    if (m_storage == STORAGE_HEAP) {
+        /* Zero-filled, large allocations come straight from the kernel and
+         * their pages are only faulted in when written */
+        m_bytes = static_cast<uint8_t*>(std::calloc(m_size, 1));
+
+        if (m_bytes == NULL) {
+            MLOG(APP, ERR) << "Cannot allocate " << m_size << " bytes\n";
+            throw std::bad_alloc();
+        }
+    }
+
+    if (blob_fn != "") {
+        load_blob(blob_fn);
+    }
+}
+
+void Memory::free_storage()
+{
+    if (m_bytes == NULL) {
+        return;
+    }
+
+    switch (m_storage) {
+    case STORAGE_HEAP:
+        std::free(m_bytes);
+        break;
+
+    case STORAGE_FILE_SHARED:
+    case STORAGE_FILE_PRIVATE:
+    case STORAGE_SPARSE:
+    case STORAGE_ANONYMOUS:
+    case STORAGE_SNAPSHOT_PRIVATE:
+        ::munmap(m_bytes, m_mapping_size);
+        break;
+    }
+
+    m_bytes = NULL;
+}
+
+void Memory::load_blob(const std::string &fn)
+{
+    MLOG(APP, DBG) << "Loading blob `" << fn << "`\n";
+
+    if (CompressedImage::is_compressed(fn)) {
+        /* Heap and anonymous mappings are zero-filled, zero chunks can be
+         * skipped */
+        bool zeroed = (m_storage == STORAGE_HEAP) || (m_storage == STORAGE_SPARSE)
+            || (m_storage == STORAGE_ANONYMOUS);
+
+        m_blob_loader = std::thread(&Memory::load_compressed_blob, this, fn, zeroed);
+        return;
+    }
+
+    FILE *f = std::fopen(fn.c_str(), "r");
+
+    if (f == NULL) {
+        MLOG(APP, ERR) << "Cannot load blob file " << fn << ". Memory will remain uninitialized\n";
+        return;
+    }
+
+    std::fseek(f, 0, SEEK_END);
+    long file_size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+
+    if (uint64_t(file_size) > m_size) {
+        MLOG(APP, WRN) << "Blob file `" << fn << "` does not fit into memory, loading will be truncated\n";
+    }
+
+    uint64_t to_read = std::min(uint64_t(file_size), m_size);
+
+    m_blob_loader = std::thread(&Memory::load_raw_blob, this, f, to_read, fn);
+}
+
+/* Runs on the blob loader thread. Must not log nor touch SystemC. */
+void Memory::load_raw_blob(FILE *f, uint64_t len, const std::string &fn)
+{
+    bool ok = true;
+
+    for (uint64_t ofs = 0; ok && ofs < len && !m_blob_abort; ofs += BLOB_CHUNK_SIZE) {
+        uint64_t chunk = std::min(BLOB_CHUNK_SIZE, len - ofs);
+
+        ok = (std::fread(m_bytes + ofs, chunk, 1, f) == 1);
+    }
+
+    std::fclose(f);
+
+    if (!ok) {
+        m_blob_error = "Error while reading blob file " + fn;
+    }
+}
+
+/* Runs on the blob loader thread. Must not log nor touch SystemC. */
+void Memory::load_compressed_blob(const std::string &fn, bool zeroed)
+{
+    uint64_t loaded;
+
+    if (!CompressedImage::load(fn, m_bytes, m_size, zeroed, loaded, &m_blob_abort)) {
+        m_blob_error = "Cannot load compressed blob file " + fn;
+        return;
+    }
+
+    if (loaded < m_size && !zeroed) {
+        /* Keep the same behaviour as a zero-filled raw blob would give */
+        std::memset(m_bytes + loaded, 0, m_size - loaded);
+    }
+}
+
+void Memory::wait_blob_loaded()
+{
+    if (!m_blob_loader.joinable()) {
+        return;
+    }
+
+    m_blob_loader.join();
+
+    if (m_blob_error != "") {
+        MLOG(APP, ERR) << m_blob_error << ". Memory content is undefined\n";
+    }
+}
+
+void Memory::dump_to_file(const std::string &fn)
+{
+    wait_blob_loaded();
+
+    FILE *f = std::fopen(fn.c_str(), "w");
+
+    MLOG(APP, DBG) << "Dumping memory in `" << fn << "`\n";
+
+    if (f == NULL) {
+        MLOG(APP, ERR) << "Cannot load file " << fn << ".\n";
+        return;
+    }
+
+    if (std::fwrite(m_bytes, m_size, 1, f) != 1) {
+        MLOG(APP, WRN) << "Error while dumping memory in " << fn << "\n";
+    }
+
+    std::fclose(f);
+}
+
+sc_time Memory::access_latency(const tlm::tlm_generic_payload &trans)
+{
+    /* A burst is charged in one go: fixed cost plus the per byte cost of
+     * the whole transfer */
+    switch (trans.get_command()) {
+    case tlm::TLM_READ_COMMAND:
+        return MEM_READ_LATENCY + MEM_READ_LATENCY_PER_BYTE * trans.get_data_length();
+
+    case tlm::TLM_WRITE_COMMAND:
+        return MEM_WRITE_LATENCY + MEM_WRITE_LATENCY_PER_BYTE * trans.get_data_length();
+
+    default:
+        return SC_ZERO_TIME;
+    }
+}
+
+sc_time Memory::dmi_latency(tlm::tlm_command cmd) const
+{
+    /* DMI latencies are per access, assumed to be one bus word wide */
+    if (cmd == tlm::TLM_WRITE_COMMAND) {
+        return MEM_WRITE_LATENCY + MEM_WRITE_LATENCY_PER_BYTE * DMI_ACCESS_SIZE;
+    }
+
+    return MEM_READ_LATENCY + MEM_READ_LATENCY_PER_BYTE * DMI_ACCESS_SIZE;
+}
+
+void Memory::b_transport(tlm::tlm_generic_payload &trans, sc_time &delay)
+{
+    sc_time lat = access_latency(trans);
+
+    if (lat != SC_ZERO_TIME) {
+        apply_latency(m_temporal_decoupling, lat, delay);
+    }
+
+    m_access_delay = delay;
+    Slave<>::b_transport(trans, delay);
+    m_access_delay = SC_ZERO_TIME;
+}
+
+bool Memory::write_raw_snapshot(const std::string &fn)
+{
+    FILE *f = std::fopen(fn.c_str(), "w");
+    SnapshotHeader hdr;
+    uint64_t h = CHECKSUM_INIT;
+    bool ok;
+
+    if (f == NULL) {
+        return false;
+    }
+
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.data_offset = SNAPSHOT_DATA_OFFSET;
+    hdr.size = m_size;
+
+    ok = (std::fseek(f, SNAPSHOT_DATA_OFFSET, SEEK_SET) == 0);
+
+    for (uint64_t ofs = 0; ok && ofs < m_size; ofs += SNAPSHOT_CHUNK_SIZE) {
+        uint64_t len = std::min(SNAPSHOT_CHUNK_SIZE, m_size - ofs);
+
+        ok = (std::fwrite(m_bytes + ofs, len, 1, f) == 1);
+        h = checksum_update(h, m_bytes + ofs, len);
+    }
+
+    /* The header goes last, once the checksum is known */
+    hdr.checksum = h;
+
+    ok = ok && (std::fseek(f, 0, SEEK_SET) == 0);
+    ok = ok && (std::fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    ok = (std::fclose(f) == 0) && ok;
+
+    return ok;
+}
+
+bool Memory::save_snapshot(const std::string &fn)
+{
+    bool ok;
+
+    MLOG(APP, DBG) << "Saving snapshot in `" << fn << "`\n";
+
+    wait_blob_loaded();
+
+    if (m_snapshot_compression) {
+        /* Zero chunks take no space in the file */
+        ok = CompressedImage::save(fn, m_bytes, m_size);
+    } else {
+        ok = write_raw_snapshot(fn);
+    }
+
+    if (!ok) {
+        MLOG(APP, ERR) << "Error while saving snapshot in " << fn << "\n";
+    } else if (m_dirty_tracking) {
+        /* New base for incremental snapshots */
+        clear_dirty();
+    }
+
+    return ok;
+}
+
+bool Memory::save_incremental_snapshot(const std::string &fn)
+{
+    IncrSnapshotHeader hdr;
+    uint64_t h = CHECKSUM_INIT;
+    uint64_t pages = (m_size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+    bool ok;
+
+    if (!m_dirty_tracking) {
+        MLOG(APP, ERR) << "Incremental snapshots require dirty tracking\n";
+        return false;
+    }
+
+    FILE *f = std::fopen(fn.c_str(), "w");
+
+    MLOG(APP, DBG) << "Saving incremental snapshot in `" << fn << "`\n";
+
+    wait_blob_loaded();
+
+    if (f == NULL) {
+        MLOG(APP, ERR) << "Cannot open snapshot file " << fn << "\n";
+        return false;
+    }
+
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, INCR_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.page_size = DIRTY_PAGE_SIZE;
+    hdr.size = m_size;
+
+    ok = (std::fseek(f, sizeof(hdr), SEEK_SET) == 0);
+
+    for (uint64_t p = 0; ok && p < pages; p++) {
+        if (!m_dirty[p / 64]) {
+            p |= 63;
+            continue;
+        }
+
+        if (!is_dirty(p)) {
+            continue;
+        }
+
+        uint64_t ofs = p * DIRTY_PAGE_SIZE;
+        uint64_t len = std::min(DIRTY_PAGE_SIZE, m_size - ofs);
+
+        ok = (std::fwrite(&p, sizeof(p), 1, f) == 1)
+            && (std::fwrite(m_bytes + ofs, len, 1, f) == 1);
+
+        h = checksum_update(h, reinterpret_cast<uint8_t*>(&p), sizeof(p));
+        h = checksum_update(h, m_bytes + ofs, len);
+        hdr.page_count++;
+    }
+
+    hdr.checksum = h;
+
+    ok = ok && (std::fseek(f, 0, SEEK_SET) == 0);
+    ok = ok && (std::fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+    ok = (std::fclose(f) == 0) && ok;
+
+    if (!ok) {
+        MLOG(APP, ERR) << "Error while saving snapshot in " << fn << "\n";
+        return false;
+    }
+
+    MLOG(APP, DBG) << hdr.page_count << " dirty pages saved\n";
+    clear_dirty();
 
-Memory::Memory(sc_core::sc_module_name name, const Parameters &params, ConfigManager &c)
-    : Slave(name, params, c)
-    , MEM_WRITE_LATENCY(3, SC_NS)
-    , MEM_READ_LATENCY(3, SC_NS)
+    return true;
+}
+
+bool Memory::restore_incremental_snapshot(const std::string &fn)
 {
-    m_size = params["size"].as<uint64_t>();
-    m_readonly = params["readonly"].as<bool>();
-    m_dmi = !params["disable-dmi"].as<bool>();
-    m_bytes = new uint8_t[m_size];
+    FILE *f = std::fopen(fn.c_str(), "r");
+    IncrSnapshotHeader hdr;
+    uint64_t h = CHECKSUM_INIT;
+    bool ok = true;
 
-    std::string blob_fn = params["file-blob"].as<std::string>();
+    MLOG(APP, DBG) << "Restoring incremental snapshot `" << fn << "`\n";
 
-    if (blob_fn != "") {
-        load_blob(blob_fn);
+    wait_blob_loaded();
+
+    if (f == NULL) {
+        MLOG(APP, ERR) << "Cannot open snapshot file " << fn << "\n";
+        return false;
+    }
+
+    if (std::fread(&hdr, sizeof(hdr), 1, f) != 1
+        || std::memcmp(hdr.magic, INCR_SNAPSHOT_MAGIC, sizeof(hdr.magic))
+        || hdr.version != SNAPSHOT_VERSION) {
+        MLOG(APP, ERR) << "`" << fn << "` is not a supported incremental memory snapshot\n";
+        std::fclose(f);
+        return false;
+    }
+
+    if (hdr.size != m_size) {
+        MLOG(APP, ERR) << "Snapshot " << fn << " size (" << hdr.size
+            << ") does not match memory size (" << m_size << ")\n";
+        std::fclose(f);
+        return false;
+    }
+
+    for (uint64_t i = 0; ok && i < hdr.page_count; i++) {
+        uint64_t p;
+
+        ok = (std::fread(&p, sizeof(p), 1, f) == 1) && (p * hdr.page_size < m_size);
+
+        if (!ok) {
+            break;
+        }
+
+        uint64_t ofs = p * hdr.page_size;
+        uint64_t len = std::min(uint64_t(hdr.page_size), m_size - ofs);
+
+        ok = (std::fread(m_bytes + ofs, len, 1, f) == 1);
+
+        h = checksum_update(h, reinterpret_cast<uint8_t*>(&p), sizeof(p));
+        h = checksum_update(h, m_bytes + ofs, len);
+
+        if (m_dirty_tracking) {
+            mark_dirty(ofs, len);
+        }
+    }
+
+    std::fclose(f);
+
+    if (!ok) {
+        MLOG(APP, ERR) << "Error while reading snapshot " << fn
+            << ". Memory content is undefined\n";
+        return false;
     }
+
+    if (h != hdr.checksum) {
+        MLOG(APP, ERR) << "Checksum mismatch in snapshot " << fn
+            << ". Memory content is undefined\n";
+        return false;
+    }
+
+    return true;
 }
 
+/* Parse a `start:size[:suffix]' entry */
+bool Memory::parse_range(const std::string &entry, uint64_t &start, uint64_t &size,
+                         std::string &suffix)
+{
+    char *p;
+
+    start = std::strtoull(entry.c_str(), &p, 0);
+    size = (*p == ':') ? std::strtoull(p + 1, &p, 0) : 0;
 
-Memory::~Memory()
+    if (*p == ':') {
+        suffix = p + 1;
+    } else if (*p == '\0') {
+        suffix = "";
+    } else {
+        return false;
+    }
+
+    suffix.erase(suffix.find_last_not_of(" \t") + 1);
+
+    return size != 0 && start < m_size && size <= m_size - start;
+}
+
+void Memory::parse_dmi_windows(const std::string &list, bool readonly)
 {
-    if (m_bytes)
-        delete[] m_bytes;
+    std::stringstream ss(list);
+    std::string entry;
+
+    while (std::getline(ss, entry, ',')) {
+        DmiWindow w;
+        uint64_t size;
+        std::string suffix;
+
+        entry.erase(0, entry.find_first_not_of(" \t"));
+        entry.erase(entry.find_last_not_of(" \t") + 1);
+
+        if (entry == "") {
+            continue;
+        }
+
+        if (!parse_range(entry, w.start, size, suffix) || suffix != "") {
+            MLOG(APP, ERR) << "Invalid DMI window `" << entry << "`. Ignoring.\n";
+            continue;
+        }
+
+        w.end = w.start + size - 1;
+        w.readonly = readonly;
+
+        auto it = std::upper_bound(m_dmi_windows.begin(), m_dmi_windows.end(), w.start,
+                                   [] (uint64_t a, const DmiWindow &b) { return a < b.start; });
+
+        if ((it != m_dmi_windows.end() && it->start <= w.end)
+            || (it != m_dmi_windows.begin() && (it - 1)->end >= w.start)) {
+            MLOG(APP, ERR) << "DMI window `" << entry << "` overlaps another one. Ignoring.\n";
+            continue;
+        }
+
+        m_dmi_windows.insert(it, w);
+    }
 }
 
-void Memory::load_blob(const std::string &fn)
+/*
+ * Restrict [start, end] to the DMI windows layout around addr. Returns false
+ * if DMI must be denied, in which case [start, end] is the denied window.
+ */
+bool Memory::dmi_window_region(uint64_t addr, uint64_t &start, uint64_t &end, bool &writable)
 {
-    FILE *f = std::fopen(fn.c_str(), "r");
+    auto it = std::upper_bound(m_dmi_windows.begin(), m_dmi_windows.end(), addr,
+                               [] (uint64_t a, const DmiWindow &b) { return a < b.start; });
 
-    MLOG(APP, DBG) << "Loading blob `" << fn << "`\n";
+    if (it != m_dmi_windows.begin() && (it - 1)->end >= addr) {
+        const DmiWindow &w = *(it - 1);
 
-    if (f == NULL) {
-        MLOG(APP, ERR) << "Cannot load blob file " << fn << ". Memory will remain uninitialized\n";
+        start = w.start;
+        end = w.end;
+        writable = false;
+
+        return w.readonly;
+    }
+
+    /* In between two windows */
+    if (it != m_dmi_windows.begin()) {
+        start = (it - 1)->end + 1;
+    }
+
+    if (it != m_dmi_windows.end()) {
+        end = it->start - 1;
+    }
+
+    return true;
+}
+
+void Memory::parse_watchpoints(const std::string &list)
+{
+    std::stringstream ss(list);
+    std::string entry;
+
+    while (std::getline(ss, entry, ',')) {
+        uint64_t start, size;
+        std::string suffix;
+        int flags = 0;
+
+        entry.erase(0, entry.find_first_not_of(" \t"));
+        entry.erase(entry.find_last_not_of(" \t") + 1);
+
+        if (entry == "") {
+            continue;
+        }
+
+        bool ok = parse_range(entry, start, size, suffix);
+
+        if (suffix == "" || suffix == "rw") {
+            flags = WATCH_READ | WATCH_WRITE;
+        } else if (suffix == "r") {
+            flags = WATCH_READ;
+        } else if (suffix == "w") {
+            flags = WATCH_WRITE;
+        }
+
+        if (!ok || !flags) {
+            MLOG(APP, ERR) << "Invalid watchpoint `" << entry << "`. Ignoring.\n";
+            continue;
+        }
+
+        /* No DMI granted yet, no need to go through add_watchpoint */
+        Watchpoint wp = { start, start + size - 1, flags };
+        m_watchpoints.push_back(wp);
+    }
+}
+
+bool Memory::add_watchpoint(uint64_t addr, uint64_t size, int flags)
+{
+    Watchpoint wp;
+
+    if (size == 0 || addr >= m_size || size > m_size - addr) {
+        MLOG(APP, ERR) << "Watchpoint out of memory bounds\n";
+        return false;
+    }
+
+    wp.start = addr;
+    wp.end = addr + size - 1;
+    wp.flags = flags;
+
+    m_watchpoints.push_back(wp);
+
+    MLOG_F(APP, DBG, "Watchpoint added on [0x%016" PRIx64 ", 0x%016" PRIx64 "]\n",
+           wp.start, wp.end);
+
+    /* Accesses to the range must now go through the bus callbacks */
+    dmi_invalidate(wp.start, wp.end);
+
+    return true;
+}
+
+bool Memory::remove_watchpoint(uint64_t addr, uint64_t size)
+{
+    for (auto it = m_watchpoints.begin(); it != m_watchpoints.end(); it++) {
+        if (it->start == addr && it->end == addr + size - 1) {
+            m_watchpoints.erase(it);
+
+            /* Let the initiators ask again for a larger DMI region */
+            dmi_invalidate(addr, addr + size - 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Same as dmi_window_region, for watchpoints. Read watchpoints deny DMI,
+ * write ones only deny write access.
+ */
+bool Memory::watchpoint_region(uint64_t addr, uint64_t &start, uint64_t &end, bool &writable)
+{
+    for (const Watchpoint &wp: m_watchpoints) {
+        if (wp.start <= addr && addr <= wp.end) {
+            if (wp.flags & WATCH_READ) {
+                start = wp.start;
+                end = wp.end;
+                return false;
+            }
+
+            start = std::max(start, wp.start);
+            end = std::min(end, wp.end);
+            writable = false;
+        } else if (wp.end < addr) {
+            start = std::max(start, wp.end + 1);
+        } else {
+            end = std::min(end, wp.start - 1);
+        }
+    }
+
+    return true;
+}
+
+void Memory::check_watchpoints(uint64_t addr, const uint8_t *data, unsigned int len, int access)
+{
+    for (const Watchpoint &wp: m_watchpoints) {
+        if (!(wp.flags & access) || wp.end < addr || wp.start > addr + len - 1) {
+            continue;
+        }
+
+        std::stringstream value;
+
+        if (len <= sizeof(uint64_t)) {
+            uint64_t v = 0;
+
+            std::memcpy(&v, data, len);
+            value << "0x" << std::hex << v;
+        } else {
+            for (unsigned int i = 0; i < len; i++) {
+                value << std::hex << std::setw(2) << std::setfill('0') << unsigned(data[i]);
+            }
+        }
+
+        MLOG_F(APP, INF, "Watchpoint hit: %s of %u bytes at 0x%016" PRIx64 ", value %s, at %s\n",
+               (access == WATCH_READ) ? "read" : "write", len, addr,
+               value.str().c_str(), sc_time_stamp().to_string().c_str());
+
+        /* Report each access once, even if several watchpoints match */
         return;
     }
+}
 
-    std::fseek(f, 0, SEEK_END);
-    long file_size = std::ftell(f);
-    std::fseek(f, 0, SEEK_SET);
+void Memory::clear_dirty()
+{
+    std::fill(m_dirty.begin(), m_dirty.end(), 0);
 
-    if (uint64_t(file_size) > m_size) {
-        MLOG(APP, WRN) << "Blob file `" << fn << "` does not fit into memory, loading will be truncated\n";
+    /* Writable DMI regions were granted on dirty pages only. Revoke them so
+     * that the next write to those pages is tracked again. */
+    dmi_invalidate(0, m_size - 1);
+}
+
+void Memory::dirty_dmi_region(uint64_t addr, uint64_t &start, uint64_t &end, bool &writable)
+{
+    uint64_t pages = (m_size + DIRTY_PAGE_SIZE - 1) / DIRTY_PAGE_SIZE;
+    uint64_t page = addr / DIRTY_PAGE_SIZE;
+    uint64_t first = page - (page % DIRTY_DMI_BLOCK_PAGES);
+    uint64_t last = std::min(first + DIRTY_DMI_BLOCK_PAGES, pages) - 1;
+    bool dirty = is_dirty(page);
+    uint64_t lo = page, hi = page;
+
+    /* Dirty pages are granted write access, clean ones are read-only so
+     * that the first write to them goes through bus_cb_write */
+    while (lo > first && is_dirty(lo - 1) == dirty) {
+        lo--;
     }
 
-    size_t to_read = std::min(uint64_t(file_size), m_size);
-    if (std::fread(m_bytes, to_read, 1, f) != 1) {
-        MLOG(APP, WRN) << "Error while reading blob file " << fn << "\n";
+    while (hi < last && is_dirty(hi + 1) == dirty) {
+        hi++;
     }
 
-    std::fclose(f);
+    start = lo * DIRTY_PAGE_SIZE;
+    end = std::min((hi + 1) * DIRTY_PAGE_SIZE, m_size) - 1;
+    writable = dirty;
 }
 
-void Memory::dump_to_file(const std::string &fn)
+void Memory::dmi_invalidate(uint64_t start, uint64_t end)
 {
-    FILE *f = std::fopen(fn.c_str(), "w");
+    /* No DMI pointer can have been handed out yet, and the socket may not be
+     * bound (e.g. snapshots restored from the constructor) */
+    if (!sc_is_running()) {
+        return;
+    }
 
-    MLOG(APP, DBG) << "Dumping memory in `" << fn << "`\n";
+    p_bus.socket->invalidate_direct_mem_ptr(start, end);
+}
+
+void Memory::checkpoint_thread()
+{
+    for (int n = 0;; n++) {
+        std::stringstream fn;
+
+        wait(m_checkpoint_period);
+
+        fn << m_checkpoint_prefix << "." << n;
+
+        /* The first checkpoint is a full snapshot, the following ones only
+         * hold the pages written since the previous one */
+        if (n == 0) {
+            save_snapshot(fn.str());
+        } else {
+            save_incremental_snapshot(fn.str());
+        }
+    }
+}
+
+bool Memory::read_snapshot_header(FILE *f, const std::string &fn)
+{
+    SnapshotHeader hdr;
+    struct stat st;
+
+    if (std::fread(&hdr, sizeof(hdr), 1, f) != 1
+        || std::memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic))) {
+        MLOG(APP, ERR) << "`" << fn << "` is not a memory snapshot\n";
+        return false;
+    }
+
+    if (hdr.version != SNAPSHOT_VERSION) {
+        MLOG(APP, ERR) << "Unsupported snapshot version " << hdr.version << " in " << fn << "\n";
+        return false;
+    }
+
+    if (hdr.size != m_size) {
+        MLOG(APP, ERR) << "Snapshot " << fn << " size (" << hdr.size
+            << ") does not match memory size (" << m_size << ")\n";
+        return false;
+    }
+
+    if (hdr.data_offset < sizeof(hdr)) {
+        MLOG(APP, ERR) << "Snapshot " << fn << " has an invalid data offset ("
+            << hdr.data_offset << ")\n";
+        return false;
+    }
+
+    if (::fstat(fileno(f), &st) == -1
+        || static_cast<uint64_t>(st.st_size) < hdr.data_offset
+        || static_cast<uint64_t>(st.st_size) - hdr.data_offset < hdr.size) {
+        MLOG(APP, ERR) << "Snapshot " << fn << " is truncated\n";
+        return false;
+    }
+
+    m_snapshot_checksum = hdr.checksum;
+    m_snapshot_data_offset = hdr.data_offset;
+
+    return true;
+}
+
+bool Memory::read_raw_snapshot(const std::string &fn)
+{
+    FILE *f = std::fopen(fn.c_str(), "r");
+    uint64_t h = CHECKSUM_INIT;
+    bool ok;
 
     if (f == NULL) {
-        MLOG(APP, ERR) << "Cannot load file " << fn << ".\n";
-        return;
+        MLOG(APP, ERR) << "Cannot open snapshot file " << fn << "\n";
+        return false;
     }
 
-    if (std::fwrite(m_bytes, m_size, 1, f) != 1) {
-        MLOG(APP, WRN) << "Error while dumping memory in " << fn << "\n";
+    if (!read_snapshot_header(f, fn)) {
+        std::fclose(f);
+        return false;
+    }
+
+    ok = (std::fseek(f, m_snapshot_data_offset, SEEK_SET) == 0);
+
+    for (uint64_t ofs = 0; ok && ofs < m_size; ofs += SNAPSHOT_CHUNK_SIZE) {
+        uint64_t len = std::min(SNAPSHOT_CHUNK_SIZE, m_size - ofs);
+
+        ok = (std::fread(m_bytes + ofs, len, 1, f) == 1);
+        h = checksum_update(h, m_bytes + ofs, len);
     }
 
     std::fclose(f);
+
+    if (!ok) {
+        MLOG(APP, ERR) << "Error while reading snapshot " << fn
+            << ". Memory content is undefined\n";
+        return false;
+    }
+
+    if (h != m_snapshot_checksum) {
+        MLOG(APP, ERR) << "Checksum mismatch in snapshot " << fn
+            << ". Memory content is undefined\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool Memory::read_compressed_snapshot(const std::string &fn)
+{
+    uint64_t size, loaded;
+
+    if (CompressedImage::get_size(fn, size) && size != m_size) {
+        MLOG(APP, ERR) << "Snapshot " << fn << " size (" << size
+            << ") does not match memory size (" << m_size << ")\n";
+        return false;
+    }
+
+    /* The content is not known to be zero anymore, zero chunks are written */
+    if (!CompressedImage::load(fn, m_bytes, m_size, false, loaded)) {
+        MLOG(APP, ERR) << "Error while reading snapshot " << fn
+            << ". Memory content is undefined\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool Memory::restore_snapshot(const std::string &fn)
+{
+    bool ok;
+
+    MLOG(APP, DBG) << "Restoring snapshot `" << fn << "`\n";
+
+    wait_blob_loaded();
+
+    if (CompressedImage::is_compressed(fn)) {
+        ok = read_compressed_snapshot(fn);
+    } else {
+        ok = read_raw_snapshot(fn);
+    }
+
+    /* Incremental snapshots hold the pages written since the last saved
+     * snapshot, which the whole content may now differ from */
+    if (m_dirty_tracking) {
+        mark_dirty(0, m_size);
+    }
+
+    /* Initiators may have translated code out of the previous content */
+    dmi_invalidate(0, m_size - 1);
+
+    return ok;
+}
+
+void Memory::start_of_simulation()
+{
+    wait_blob_loaded();
+}
+
+void Memory::end_of_simulation()
+{
+    if (m_snapshot_save != "") {
+        save_snapshot(m_snapshot_save);
+    }
+
+    if (m_trace) {
+        m_trace->close();
+
+        if (m_trace->get_stalls()) {
+            MLOG(APP, DBG) << "Trace writer could not keep up " << m_trace->get_stalls() << " times\n";
+        }
+
+        /* Nothing drains the ring anymore, stop recording */
+        delete m_trace;
+        m_trace = NULL;
+    }
 }
 
 void Memory::bus_cb_read(uint64_t addr, uint8_t *data, unsigned int len, bool &bErr)
 {
-    MLOG_F(SIM, TRC, "Memory read access at %016" PRIx64 " of size %u\n", addr, len);
-    wait(MEM_READ_LATENCY);
+    HOTPATH_MLOG_F(SIM, TRC, "Memory read access at %016" PRIx64 " of size %u\n", addr, len);
 
     if (addr + len > m_size) {
         MLOG(SIM, ERR) << "reading outside bounds\n";
@@ -109,12 +1334,19 @@ void Memory::bus_cb_read(uint64_t addr, uint8_t *data, unsigned int len, bool &b
     }
 
     memcpy(data, m_bytes + addr, len);
+
+    if (m_trace) {
+        m_trace->record((sc_time_stamp() + m_access_delay).value(), addr, data, len, false);
+    }
+
+    if (!m_watchpoints.empty()) {
+        check_watchpoints(addr, data, len, WATCH_READ);
+    }
 }
 
 void Memory::bus_cb_write(uint64_t addr, uint8_t *data, unsigned int len, bool &bErr)
 {
-    MLOG_F(SIM, TRC, "Memory write access at %016" PRIx64 " of size %u\n", addr, len);
-    wait(MEM_WRITE_LATENCY);
+    HOTPATH_MLOG_F(SIM, TRC, "Memory write access at %016" PRIx64 " of size %u\n", addr, len);
 
     if (m_readonly) {
         MLOG(SIM, ERR) << "trying to write to read-only memory\n";
@@ -128,12 +1360,31 @@ void Memory::bus_cb_write(uint64_t addr, uint8_t *data, unsigned int len, bool &
         return;
     }
 
+    if (m_dirty_tracking) {
+        mark_dirty(addr, len);
+    }
+
+    if (m_trace) {
+        m_trace->record((sc_time_stamp() + m_access_delay).value(), addr, data, len, true);
+    }
+
+    if (!m_watchpoints.empty()) {
+        check_watchpoints(addr, data, len, WATCH_WRITE);
+    }
+
     memcpy(m_bytes + addr, data, len);
 }
 
 uint64_t Memory::debug_read(uint64_t addr, uint8_t *buf, uint64_t size)
 {
-    unsigned int to_read = (addr + size > m_size) ? m_size - addr : size;
+    /* Debug accesses may come from elaboration time plugins */
+    wait_blob_loaded();
+
+    if (addr >= m_size) {
+        return 0;
+    }
+
+    uint64_t to_read = (addr + size > m_size) ? m_size - addr : size;
 
     memcpy(buf, m_bytes + addr, to_read);
 
@@ -142,7 +1393,17 @@ uint64_t Memory::debug_read(uint64_t addr, uint8_t *buf, uint64_t size)
 
 uint64_t Memory::debug_write(uint64_t addr, const uint8_t *buf, uint64_t size)
 {
-    unsigned int to_write = (addr + size > m_size) ? m_size - addr : size;
+    wait_blob_loaded();
+
+    if (addr >= m_size) {
+        return 0;
+    }
+
+    uint64_t to_write = (addr + size > m_size) ? m_size - addr : size;
+
+    if (m_dirty_tracking && to_write) {
+        mark_dirty(addr, to_write);
+    }
 
     memcpy(m_bytes + addr, buf, to_write);
 
@@ -152,27 +1413,56 @@ uint64_t Memory::debug_write(uint64_t addr, const uint8_t *buf, uint64_t size)
 bool Memory::get_direct_mem_ptr(tlm::tlm_generic_payload& trans,
                                 tlm::tlm_dmi& dmi_data)
 {
+    wait_blob_loaded();
+
     if (!m_dmi) {
         MLOG(APP, TRC) << "DMI disabled for this memory\n";
         return false;
     }
 
-    if (trans.get_address() > m_size) {
+    if (trans.get_address() >= m_size) {
         return false;
     }
 
-    dmi_data.set_start_address(0);
-    dmi_data.set_end_address(m_size-1);
-    dmi_data.set_dmi_ptr(m_bytes);
+    uint64_t start = 0, end = m_size - 1;
+    bool writable = !m_readonly;
 
-    if (m_readonly) {
-        dmi_data.set_granted_access(tlm::tlm_dmi::DMI_ACCESS_READ);
-    } else {
+    if (!dmi_window_region(trans.get_address(), start, end, writable)) {
+        /* Tell the initiator which range it should not ask again for */
+        dmi_data.set_start_address(start);
+        dmi_data.set_end_address(end);
+        dmi_data.set_granted_access(tlm::tlm_dmi::DMI_ACCESS_NONE);
+        return false;
+    }
+
+    if (!m_watchpoints.empty()
+        && !watchpoint_region(trans.get_address(), start, end, writable)) {
+        dmi_data.set_start_address(start);
+        dmi_data.set_end_address(end);
+        dmi_data.set_granted_access(tlm::tlm_dmi::DMI_ACCESS_NONE);
+        return false;
+    }
+
+    if (m_dirty_tracking && writable) {
+        uint64_t dirty_start, dirty_end;
+
+        dirty_dmi_region(trans.get_address(), dirty_start, dirty_end, writable);
+        start = std::max(start, dirty_start);
+        end = std::min(end, dirty_end);
+    }
+
+    dmi_data.set_start_address(start);
+    dmi_data.set_end_address(end);
+    dmi_data.set_dmi_ptr(m_bytes + start);
+
+    if (writable) {
         dmi_data.set_granted_access(tlm::tlm_dmi::DMI_ACCESS_READ_WRITE);
+    } else {
+        dmi_data.set_granted_access(tlm::tlm_dmi::DMI_ACCESS_READ);
     }
 
-    dmi_data.set_write_latency(MEM_WRITE_LATENCY);
-    dmi_data.set_read_latency(MEM_READ_LATENCY);
+    dmi_data.set_write_latency(dmi_latency(tlm::TLM_WRITE_COMMAND));
+    dmi_data.set_read_latency(dmi_latency(tlm::TLM_READ_COMMAND));
 
     return true;
 }
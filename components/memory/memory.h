@@ -20,18 +20,144 @@
 #ifndef _MEM_DEVICE_H_
 #define _MEM_DEVICE_H_
 
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <atomic>
+
 #include <rabbits/component/slave.h>
 
+#include "access_trace.h"
+
 class Memory: public Slave<>
 {
 protected:
+    static const uint64_t DIRTY_PAGE_SIZE = 4096;
+
+    /* In dirty tracking mode, DMI regions do not cross such blocks. This
+     * bounds the bitmap walk done on each DMI request. */
+    static const uint64_t DIRTY_DMI_BLOCK_PAGES = 512;
+
+    enum Storage {
+        STORAGE_HEAP,         /* Allocated on the heap, blob copied in */
+        STORAGE_FILE_SHARED,  /* Blob file mapped, writes go to the file */
+        STORAGE_FILE_PRIVATE, /* Blob file mapped copy-on-write */
+        STORAGE_SPARSE,       /* Address space reserved, pages allocated on write */
+        STORAGE_ANONYMOUS,    /* Anonymous mapping, used for heap with huge pages */
+        STORAGE_SNAPSHOT_PRIVATE, /* Snapshot file mapped copy-on-write */
+    };
+
+    enum HugePages {
+        HUGE_PAGES_NONE,
+        HUGE_PAGES_TRANSPARENT,
+        HUGE_PAGES_HUGETLBFS,
+    };
+
+    Storage m_storage;
+    HugePages m_huge_pages;
+    uint64_t m_mapping_size;
     uint64_t m_size;
     bool m_readonly;
     uint8_t *m_bytes;
     bool m_dmi;
 
+    /* Windows where DMI is restricted, sorted and non overlapping */
+    struct DmiWindow {
+        uint64_t start;
+        uint64_t end;
+        bool readonly; /* DMI granted for reads only, otherwise not at all */
+    };
+
+    std::vector<DmiWindow> m_dmi_windows;
+
+    struct Watchpoint {
+        uint64_t start;
+        uint64_t end;
+        int flags;
+    };
+
+    /* Usually a handful of entries, searched linearly */
+    std::vector<Watchpoint> m_watchpoints;
+
+    AccessTrace *m_trace;
+
+    /* Annotated delay of the b_transport access in progress, so that
+     * decoupled accesses are traced at their local time */
+    sc_core::sc_time m_access_delay;
+
+    std::string m_snapshot_save;
+    bool m_snapshot_compression;
+    uint64_t m_snapshot_checksum;
+    uint64_t m_snapshot_data_offset;
+    bool m_temporal_decoupling;
+
+    bool m_dirty_tracking;
+    std::vector<uint64_t> m_dirty;
+
+    sc_core::sc_time m_checkpoint_period;
+    std::string m_checkpoint_prefix;
+
+    /* The blob is loaded on a host thread, started at construction and
+     * joined by wait_blob_loaded() before the content is first needed */
+    std::thread m_blob_loader;
+    std::atomic<bool> m_blob_abort;
+    std::string m_blob_error;
+
+    AccessTraceSampling parse_trace_sampling(const std::string &mode);
+
+    bool map_file(const std::string &fn, bool shared);
+    bool map_anonymous(bool noreserve);
+    bool map_snapshot(const std::string &fn);
+    void alloc_storage(const std::string &blob_fn, const std::string &snapshot_fn);
+    void free_storage();
+
     void load_blob(const std::string &fn);
+    void load_raw_blob(FILE *f, uint64_t len, const std::string &fn);
+    void load_compressed_blob(const std::string &fn, bool zeroed);
+    void wait_blob_loaded();
     void dump_to_file(const std::string &fn);
+    bool read_snapshot_header(FILE *f, const std::string &fn);
+    bool write_raw_snapshot(const std::string &fn);
+    bool read_raw_snapshot(const std::string &fn);
+    bool read_compressed_snapshot(const std::string &fn);
+
+    bool is_dirty(uint64_t page) const
+    {
+        return (m_dirty[page / 64] >> (page % 64)) & 1;
+    }
+
+    void mark_dirty(uint64_t addr, uint64_t len)
+    {
+        if (len == 0) {
+            return;
+        }
+
+        for (uint64_t p = addr / DIRTY_PAGE_SIZE; p <= (addr + len - 1) / DIRTY_PAGE_SIZE; p++) {
+            m_dirty[p / 64] |= uint64_t(1) << (p % 64);
+        }
+    }
+
+    bool parse_range(const std::string &entry, uint64_t &start, uint64_t &size,
+                     std::string &suffix);
+    void parse_dmi_windows(const std::string &list, bool readonly);
+    bool dmi_window_region(uint64_t addr, uint64_t &start, uint64_t &end, bool &writable);
+
+    void parse_watchpoints(const std::string &list);
+    bool watchpoint_region(uint64_t addr, uint64_t &start, uint64_t &end, bool &writable);
+    void check_watchpoints(uint64_t addr, const uint8_t *data, unsigned int len, int access);
+
+    void clear_dirty();
+    void dirty_dmi_region(uint64_t addr, uint64_t &start, uint64_t &end, bool &writable);
+    void dmi_invalidate(uint64_t start, uint64_t end);
+
+    void checkpoint_thread();
+
+    /* Timing hooks, overridden by memories with address dependent timings */
+    virtual sc_core::sc_time access_latency(const tlm::tlm_generic_payload &trans);
+    virtual sc_core::sc_time dmi_latency(tlm::tlm_command cmd) const;
+
+
+    virtual void b_transport(tlm::tlm_generic_payload &trans, sc_core::sc_time &delay);
 
     void bus_cb_read(uint64_t addr, uint8_t *data, unsigned int len, bool &bErr);
     void bus_cb_write(uint64_t addr, uint8_t *data, unsigned int len, bool &bErr);
@@ -42,11 +168,42 @@ protected:
     virtual bool get_direct_mem_ptr(tlm::tlm_generic_payload& trans, tlm::tlm_dmi& dmi_data);
 
 public:
-    const sc_core::sc_time MEM_WRITE_LATENCY;
-    const sc_core::sc_time MEM_READ_LATENCY;
+    SC_HAS_PROCESS(Memory);
+
+    enum WatchpointFlags {
+        WATCH_READ = 1 << 0,
+        WATCH_WRITE = 1 << 1,
+    };
+
+    sc_core::sc_time MEM_WRITE_LATENCY;
+    sc_core::sc_time MEM_READ_LATENCY;
+
+    /* Per byte costs, added to the fixed latencies above */
+    sc_core::sc_time MEM_WRITE_LATENCY_PER_BYTE;
+    sc_core::sc_time MEM_READ_LATENCY_PER_BYTE;
 
     Memory(sc_core::sc_module_name name, const Parameters &params, ConfigManager &c);
     virtual ~Memory();
+
+    /* Save or restore the whole memory content. Snapshots carry a header
+     * with the memory size and a checksum of the content, or are compressed
+     * images when `snapshot-compression' is set. Both formats are accepted
+     * on restore. */
+    bool save_snapshot(const std::string &fn);
+    bool restore_snapshot(const std::string &fn);
+
+    /* Save or apply the pages written since the last snapshot. Requires
+     * dirty tracking. */
+    bool save_incremental_snapshot(const std::string &fn);
+    bool restore_incremental_snapshot(const std::string &fn);
+
+    /* Report bus accesses to [addr, addr + size). The range is excluded from
+     * DMI, DMI regions already granted on it are invalidated. */
+    bool add_watchpoint(uint64_t addr, uint64_t size, int flags = WATCH_READ | WATCH_WRITE);
+    bool remove_watchpoint(uint64_t addr, uint64_t size);
+
+    void start_of_simulation();
+    void end_of_simulation();
 };
 
 #endif
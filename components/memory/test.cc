@@ -25,9 +25,15 @@
 #include <cstring>
 #include <cstdio>
 #include <fstream>
+#include <chrono>
 
 #include <boost/filesystem.hpp>
 
+#include "memory.h"
+#include "dram.h"
+#include "compressed_image.h"
+#include "access_trace.h"
+
 using namespace sc_core;
 using boost::filesystem::path;
 
@@ -36,7 +42,30 @@ const sc_time MEM_WRITE_LATENCY(3, SC_NS);
 
 const int BLOB_SIZE = 1024;
 
-template <bool READONLY = false, bool LOAD_BLOB = false, uint64_t _MEM_SIZE=0x1000>
+enum TestStorage {
+    TEST_STORAGE_HEAP,
+    TEST_STORAGE_FILE_SHARED,
+    TEST_STORAGE_FILE_PRIVATE,
+    TEST_STORAGE_SPARSE,
+};
+
+static const char * storage_name(TestStorage s)
+{
+    switch (s) {
+    case TEST_STORAGE_FILE_SHARED:
+        return "file-shared";
+    case TEST_STORAGE_FILE_PRIVATE:
+        return "file-private";
+    case TEST_STORAGE_SPARSE:
+        return "sparse";
+    case TEST_STORAGE_HEAP:
+    default:
+        return "heap";
+    }
+}
+
+template <bool READONLY = false, bool LOAD_BLOB = false, uint64_t _MEM_SIZE=0x1000,
+          TestStorage STORAGE = TEST_STORAGE_HEAP, bool HUGE_PAGES = false>
 class MemoryTester : public TestBench {
 protected:
     static const uint64_t MEM_SIZE = _MEM_SIZE;
@@ -46,13 +75,17 @@ protected:
 
     std::vector<uint8_t> m_blob;
 
-    MemoryTester(sc_module_name n, ConfigManager &c) : TestBench(n, c), tst("slave-tester", c)
+    MemoryTester(sc_module_name n, ConfigManager &c, const std::string &extra_yml = "")
+        : TestBench(n, c), tst("slave-tester", c)
     {
         std::stringstream yml;
         std::string blob_path;
 
         yml << "size: " << MEM_SIZE << "\n";
         yml << "readonly: " << READONLY << "\n";
+        yml << "storage: " << storage_name(STORAGE) << "\n";
+        yml << "huge-pages: " << (HUGE_PAGES ? "transparent" : "none") << "\n";
+        yml << extra_yml;
 
         if (LOAD_BLOB) {
             blob_path = create_blob();
@@ -83,6 +116,30 @@ protected:
         return blob_path;
     }
 
+    /* Random 64 bits read-modify-write accesses through the DMI pointer.
+     * Returns the mean access time in nanoseconds. */
+    double dmi_random_access_bench(const DmiInfo &dmi, uint64_t count) {
+        uint64_t *words = reinterpret_cast<uint64_t*>(dmi.ptr);
+        uint64_t nwords = MEM_SIZE / sizeof(uint64_t);
+        uint64_t x = 88172645463325252ull;
+
+        /* Fault all the pages in first, we only want TLB effects */
+        std::memset(dmi.ptr, 0, MEM_SIZE);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (uint64_t i = 0; i < count; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            words[x % nwords] += i;
+        }
+
+        auto stop = std::chrono::steady_clock::now();
+
+        return std::chrono::duration<double, std::nano>(stop - start).count() / count;
+    }
+
     void mute_logger() {
         get_app_logger().mute();
         get_sim_logger().mute();
@@ -154,6 +211,321 @@ RABBITS_UNIT_TESTBENCH(dmi, MemoryTester<>)
     RABBITS_TEST_ASSERT_EQ(mem[0x40], 0xdeadbeef);
 }
 
+class BurstLatencyTester : public MemoryTester<> {
+public:
+    BurstLatencyTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<>(n, c, "read-latency: 10 ns\n"
+                               "read-latency-per-byte: 1 ns\n"
+                               "write-latency: 20 ns\n"
+                               "write-latency-per-byte: 2 ns\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(burst_latency, BurstLatencyTester)
+{
+    uint8_t buf[64];
+    DmiInfo dmi;
+
+    std::memset(buf, 0x5a, sizeof(buf));
+
+    /* A burst is charged once, fixed plus per byte cost */
+    tst.bus_write(0x0, buf, sizeof(buf));
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(20 + 2 * 64, SC_NS));
+
+    tst.bus_read(0x0, buf, sizeof(buf));
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(10 + 64, SC_NS));
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT_EQ(dmi.read_latency, sc_time(10 + 4, SC_NS));
+    RABBITS_TEST_ASSERT_EQ(dmi.write_latency, sc_time(20 + 2 * 4, SC_NS));
+}
+
+/* Blocking access through the tester socket, returns the annotated delay */
+static sc_time b_access(SlaveTester<> &tst, tlm::tlm_command cmd, uint64_t addr,
+                        uint32_t &data, sc_time delay = SC_ZERO_TIME)
+{
+    tlm::tlm_generic_payload trans;
+
+    trans.set_command(cmd);
+    trans.set_address(addr);
+    trans.set_data_ptr(reinterpret_cast<uint8_t*>(&data));
+    trans.set_data_length(sizeof(data));
+    trans.set_streaming_width(sizeof(data));
+    trans.set_byte_enable_ptr(nullptr);
+    trans.set_response_status(tlm::TLM_INCOMPLETE_RESPONSE);
+
+    tst.p_bus.socket->b_transport(trans, delay);
+    RABBITS_TEST_ASSERT(trans.is_response_ok());
+
+    return delay;
+}
+
+class DecoupledTester : public MemoryTester<> {
+public:
+    DecoupledTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<>(n, c, "temporal-decoupling: true\n"
+                               "global-quantum: 1 us\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(temporal_decoupling, DecoupledTester)
+{
+    uint32_t data = 0xdecacafe;
+    sc_time start = sc_time_stamp();
+    sc_dt::uint64 deltas = sc_delta_count();
+    sc_time delay;
+
+    /* Latencies are annotated, without any context switch */
+    delay = b_access(tst, tlm::TLM_WRITE_COMMAND, 0x10, data);
+    RABBITS_TEST_ASSERT_EQ(delay, MEM_WRITE_LATENCY);
+
+    data = 0;
+    delay = b_access(tst, tlm::TLM_READ_COMMAND, 0x10, data, delay);
+    RABBITS_TEST_ASSERT_EQ(delay, MEM_WRITE_LATENCY + MEM_READ_LATENCY);
+    RABBITS_TEST_ASSERT_EQ(data, 0xdecacafe);
+
+    RABBITS_TEST_ASSERT_EQ(sc_time_stamp(), start);
+    RABBITS_TEST_ASSERT_EQ(sc_delta_count(), deltas);
+
+    /* Past the quantum, the initiator is synchronized */
+    delay = b_access(tst, tlm::TLM_READ_COMMAND, 0x10, data, sc_time(1, SC_US));
+    RABBITS_TEST_ASSERT_EQ(delay, SC_ZERO_TIME);
+    RABBITS_TEST_ASSERT_EQ(sc_time_stamp(), start + sc_time(1, SC_US) + MEM_READ_LATENCY);
+}
+
+class DmiWindowsTester : public MemoryTester<> {
+public:
+    DmiWindowsTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<>(n, c, "dmi-exclude: \"0x100:0x100\"\n"
+                               "dmi-readonly: \"0x400:0x100\"\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(dmi_windows, DmiWindowsTester)
+{
+    DmiInfo dmi;
+
+    /* DMI stops right before the first window */
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT(dmi.is_read_write_allowed());
+    RABBITS_TEST_ASSERT_EQ(dmi.range, AddressRange(0, 0x100));
+
+    /* Windows are still accessible through the bus */
+    tst.bus_write_u32(0x100, 0xdecacafe);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(0x100), 0xdecacafe);
+
+    tst.bus_write_u32(0x400, 0xf00df00d);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x400), 0xf00df00d);
+}
+
+class WatchpointTester : public MemoryTester<> {
+public:
+    WatchpointTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<>(n, c, "watchpoints: \"0x100:4:w\"\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(watchpoints, WatchpointTester)
+{
+    Memory *m = dynamic_cast<Memory*>(mem);
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(m != NULL);
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT(dmi.is_read_write_allowed());
+    RABBITS_TEST_ASSERT_EQ(dmi.range, AddressRange(0, 0x100));
+
+    tst.bus_write_u32(0x100, 0xdecacafe);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(0x100), 0xdecacafe);
+
+    /* A read watchpoint denies DMI altogether */
+    RABBITS_TEST_ASSERT(m->add_watchpoint(0x0, 0x10, Memory::WATCH_READ));
+    RABBITS_TEST_ASSERT(!tst.get_dmi_info(dmi));
+
+    RABBITS_TEST_ASSERT(m->remove_watchpoint(0x0, 0x10));
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+}
+
+static const std::string TRACE_FILE = boost::filesystem::unique_path().string();
+
+/* Memory recording its accesses in TRACE_FILE */
+class TraceTester : public MemoryTester<> {
+protected:
+    TraceTester(sc_module_name n, ConfigManager &c, const std::string &extra_yml)
+        : MemoryTester<>(n, c, "trace-file: " + TRACE_FILE + "\n" + extra_yml)
+    {}
+
+    /* Close the trace and decode it back. Returns the estimated access
+     * count, as the decoder summary does. */
+    uint64_t read_trace(std::vector<AccessTraceRecord> &records)
+    {
+        Memory *m = dynamic_cast<Memory*>(mem);
+        AccessTraceReader trace;
+        AccessTraceRecord r;
+
+        RABBITS_TEST_ASSERT(m != NULL);
+        m->end_of_simulation();
+
+        RABBITS_TEST_ASSERT_EQ(trace.open(TRACE_FILE), AccessTraceReader::OK);
+
+        records.clear();
+
+        while (trace.read(r)) {
+            records.push_back(r);
+        }
+
+        return records.size() * trace.get_scale();
+    }
+
+public:
+    ~TraceTester() {
+        std::remove(TRACE_FILE.c_str());
+    }
+};
+
+class DecoupledTraceTester : public TraceTester {
+public:
+    DecoupledTraceTester(sc_module_name n, ConfigManager &c)
+        : TraceTester(n, c, "trace-data: true\n"
+                            "temporal-decoupling: true\n"
+                            "global-quantum: 1 us\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(trace, DecoupledTraceTester)
+{
+    std::vector<AccessTraceRecord> records;
+    const uint32_t value = 0xdecacafe;
+    uint32_t data = value;
+    sc_time start = sc_time_stamp();
+    sc_time delay;
+
+    /* Recorded at the initiator local time */
+    delay = b_access(tst, tlm::TLM_WRITE_COMMAND, 0x10, data, sc_time(100, SC_NS));
+    data = 0;
+    delay = b_access(tst, tlm::TLM_READ_COMMAND, 0x10, data, delay);
+
+    RABBITS_TEST_ASSERT_EQ(read_trace(records), 2);
+
+    RABBITS_TEST_ASSERT_EQ(records[0].time,
+                           (start + sc_time(100, SC_NS) + MEM_WRITE_LATENCY).value());
+    RABBITS_TEST_ASSERT_EQ(records[0].addr, 0x10);
+    RABBITS_TEST_ASSERT_EQ(records[0].size, 4);
+    RABBITS_TEST_ASSERT_EQ(records[0].flags,
+                           AccessTraceRecord::WRITE | AccessTraceRecord::HAS_DATA);
+    RABBITS_TEST_ASSERT(std::memcmp(records[0].data, &value, sizeof(value)) == 0);
+
+    RABBITS_TEST_ASSERT_EQ(records[1].time, (start + delay).value());
+    RABBITS_TEST_ASSERT_EQ(records[1].flags, AccessTraceRecord::HAS_DATA);
+
+    /* Once closed, accesses are not recorded anymore. More of them than
+     * the trace ring can hold, which must not wait for a writer. */
+    for (int i = 0; i < (1 << 17); i++) {
+        tst.bus_write_u32(0x20, i);
+    }
+
+    RABBITS_TEST_ASSERT_EQ(read_trace(records), 2);
+}
+
+const int SAMPLED_ACCESSES = 4000;
+
+class EveryNthTraceTester : public TraceTester {
+public:
+    EveryNthTraceTester(sc_module_name n, ConfigManager &c)
+        : TraceTester(n, c, "trace-sampling: every-nth\n"
+                            "trace-sampling-rate: 4\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(trace_every_nth, EveryNthTraceTester)
+{
+    std::vector<AccessTraceRecord> records;
+
+    for (int i = 0; i < SAMPLED_ACCESSES; i++) {
+        tst.bus_write_u32((i * 4) % MEM_SIZE, i);
+    }
+
+    RABBITS_TEST_ASSERT_EQ(read_trace(records), SAMPLED_ACCESSES);
+    RABBITS_TEST_ASSERT_EQ(records.size(), SAMPLED_ACCESSES / 4);
+
+    /* The fourth access, then one every four */
+    for (unsigned int i = 0; i < records.size(); i++) {
+        RABBITS_TEST_ASSERT_EQ(records[i].addr, ((4 * i + 3) * 4) % MEM_SIZE);
+    }
+}
+
+class RandomTraceTester : public TraceTester {
+public:
+    RandomTraceTester(sc_module_name n, ConfigManager &c)
+        : TraceTester(n, c, "trace-sampling: random\n"
+                            "trace-sampling-rate: 4\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(trace_random, RandomTraceTester)
+{
+    std::vector<AccessTraceRecord> records;
+
+    for (int i = 0; i < SAMPLED_ACCESSES; i++) {
+        tst.bus_write_u32((i * 4) % MEM_SIZE, i);
+    }
+
+    /* Gaps are uniform in [1, 7]: about 16 records of standard deviation
+     * over 1000 */
+    uint64_t estimated = read_trace(records);
+
+    RABBITS_TEST_ASSERT_EQ(estimated, records.size() * 4);
+    RABBITS_TEST_ASSERT(records.size() > SAMPLED_ACCESSES / 4 - 100);
+    RABBITS_TEST_ASSERT(records.size() < SAMPLED_ACCESSES / 4 + 100);
+}
+
+const sc_time TRACE_WINDOW_PERIOD(1, SC_US);
+const sc_time TRACE_WINDOW_LENGTH(100, SC_NS);
+
+class WindowTraceTester : public TraceTester {
+public:
+    WindowTraceTester(sc_module_name n, ConfigManager &c)
+        : TraceTester(n, c, "trace-sampling: window\n"
+                            "trace-window-period: 1 us\n"
+                            "trace-window-length: 100 ns\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(trace_window, WindowTraceTester)
+{
+    std::vector<AccessTraceRecord> records;
+    uint64_t period = TRACE_WINDOW_PERIOD.value();
+    uint64_t length = TRACE_WINDOW_LENGTH.value();
+    uint64_t expected = 0;
+
+    /* One access every 50 ns plus the write latency, over a few periods */
+    for (int i = 0; i < 100; i++) {
+        tst.bus_write_u32(0x0, i);
+
+        if (sc_time_stamp().value() % period < length) {
+            expected++;
+        }
+
+        wait(50, SC_NS);
+    }
+
+    RABBITS_TEST_ASSERT(expected > 0 && expected < 100);
+
+    /* Window sampled traces are not scaled */
+    RABBITS_TEST_ASSERT_EQ(read_trace(records), expected);
+    RABBITS_TEST_ASSERT_EQ(records.size(), expected);
+
+    for (unsigned int i = 0; i < records.size(); i++) {
+        RABBITS_TEST_ASSERT(records[i].time % period < length);
+    }
+}
+
 RABBITS_UNIT_TESTBENCH(access_boundary, MemoryTester<>)
 {
     tst.bus_write_u32(MEM_SIZE - 4, 0xf00df00d);
@@ -229,3 +601,617 @@ RABBITS_UNIT_TESTBENCH(load_blob_trunc, MemoryTester<false COMMA true COMMA BLOB
 
     RABBITS_TEST_ASSERT_EQ(std::memcmp(&m_blob[0], dmi.ptr, MEM_SIZE), 0);
 }
+
+RABBITS_UNIT_TESTBENCH(file_private, MemoryTester<false COMMA true COMMA 0x1000 COMMA TEST_STORAGE_FILE_PRIVATE>)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT_EQ(std::memcmp(&m_blob[0], dmi.ptr, BLOB_SIZE), 0);
+
+    /* Past the end of the file, the mapping is zero-filled and writable */
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(MEM_SIZE - 4), 0);
+
+    tst.bus_write_u32(MEM_SIZE - 4, 0xf00df00d);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(MEM_SIZE - 4), 0xf00df00d);
+}
+
+RABBITS_UNIT_TESTBENCH(file_shared, MemoryTester<false COMMA true COMMA 0x1000 COMMA TEST_STORAGE_FILE_SHARED>)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT_EQ(std::memcmp(&m_blob[0], dmi.ptr, BLOB_SIZE), 0);
+
+    tst.bus_write_u32(MEM_SIZE - 4, 0xf00df00d);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(MEM_SIZE - 4), 0xf00df00d);
+}
+
+RABBITS_UNIT_TESTBENCH(sparse, MemoryTester<false COMMA false COMMA (4ull << 30) COMMA TEST_STORAGE_SPARSE>)
+{
+    /* Untouched pages read as zero */
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(MEM_SIZE / 2), 0);
+
+    tst.bus_write_u32(MEM_SIZE - 4, 0xf00df00d);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(tst.bus_read_u32(MEM_SIZE - 4), 0xf00df00d);
+}
+
+RABBITS_UNIT_TESTBENCH(sparse_load_blob, MemoryTester<false COMMA true COMMA 0x100000 COMMA TEST_STORAGE_SPARSE>)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT_EQ(std::memcmp(&m_blob[0], dmi.ptr, BLOB_SIZE), 0);
+}
+
+/* Zero, compressible and incompressible chunks, in that order */
+static std::vector<uint8_t> compressed_blob_content()
+{
+    const uint32_t chunk = 4096;
+    std::vector<uint8_t> content(3 * chunk, 0);
+    uint32_t x = 2463534242u;
+
+    for (uint32_t i = 0; i < chunk; i++) {
+        content[chunk + i] = i % 7;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        content[2 * chunk + i] = x;
+    }
+
+    return content;
+}
+
+class CompressedBlobTester
+    : public MemoryTester<false, false, 0x100000, TEST_STORAGE_SPARSE> {
+protected:
+    static std::string blob_path() {
+        static const std::string path = boost::filesystem::unique_path().string();
+        return path;
+    }
+
+    static std::string create_compressed_blob() {
+        std::vector<uint8_t> content = compressed_blob_content();
+
+        CompressedImage::save(blob_path(), &content[0], content.size(), 4096);
+
+        return "file-blob: " + blob_path() + "\n";
+    }
+
+public:
+    CompressedBlobTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester(n, c, create_compressed_blob())
+    {
+        m_blob = compressed_blob_content();
+        std::remove(blob_path().c_str());
+    }
+};
+
+RABBITS_UNIT_TESTBENCH(compressed_blob, CompressedBlobTester)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT_EQ(std::memcmp(&m_blob[0], dmi.ptr, m_blob.size()), 0);
+
+    /* Past the end of the image, memory reads as zero */
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(MEM_SIZE - 4), 0);
+}
+
+/* Memory with its debug and DMI interfaces at hand during elaboration */
+class EarlyAccessMemory : public Memory {
+public:
+    EarlyAccessMemory(sc_module_name n, const Parameters &p, ConfigManager &c)
+        : Memory(n, p, c) {}
+
+    uint32_t early_read_u32(uint64_t addr)
+    {
+        uint32_t v = 0;
+
+        debug_read(addr, reinterpret_cast<uint8_t*>(&v), sizeof(v));
+        return v;
+    }
+
+    const uint8_t * early_dmi_ptr()
+    {
+        tlm::tlm_generic_payload trans;
+        tlm::tlm_dmi dmi;
+
+        trans.set_command(tlm::TLM_READ_COMMAND);
+        trans.set_address(0);
+
+        return get_direct_mem_ptr(trans, dmi) ? dmi.get_dmi_ptr() : NULL;
+    }
+};
+
+const uint64_t ASYNC_BLOB_SIZE = 16 << 20;
+
+/* The blob is still being decompressed on the loader thread when the
+ * memory is first accessed, from the testbench constructor */
+class AsyncBlobTester : public TestBench {
+protected:
+    EarlyAccessMemory *m_mem;
+    SlaveTester<> tst;
+    uint32_t m_early_value;
+    bool m_early_dmi_ok;
+
+    static uint32_t pattern(uint64_t i) { return i * 2654435761u; }
+
+public:
+    AsyncBlobTester(sc_module_name n, ConfigManager &c)
+        : TestBench(n, c), tst("slave-tester", c)
+    {
+        std::string fn = boost::filesystem::unique_path().string();
+        std::vector<uint32_t> content(ASYNC_BLOB_SIZE / sizeof(uint32_t));
+
+        for (uint64_t i = 0; i < content.size(); i++) {
+            content[i] = pattern(i);
+        }
+
+        CompressedImage::save(fn, reinterpret_cast<uint8_t*>(&content[0]), ASYNC_BLOB_SIZE);
+
+        Parameters p = c.get_component_manager().find_by_type("memory")->get_params();
+        p["size"].set(ASYNC_BLOB_SIZE);
+        p["file-blob"].set(fn);
+
+        m_mem = new EarlyAccessMemory("async-mem", p, c);
+        m_mem->get_port("mem").connect(tst.get_port("mem"));
+
+        /* Both wait for the loader */
+        m_early_value = m_mem->early_read_u32(ASYNC_BLOB_SIZE - 4);
+
+        const uint8_t *dmi = m_mem->early_dmi_ptr();
+        m_early_dmi_ok = (dmi != NULL)
+            && std::memcmp(dmi, &content[0], ASYNC_BLOB_SIZE) == 0;
+
+        std::remove(fn.c_str());
+    }
+
+    ~AsyncBlobTester() {
+        delete m_mem;
+    }
+};
+
+RABBITS_UNIT_TESTBENCH(compressed_blob_async, AsyncBlobTester)
+{
+    RABBITS_TEST_ASSERT_EQ(m_early_value, pattern(ASYNC_BLOB_SIZE / sizeof(uint32_t) - 1));
+    RABBITS_TEST_ASSERT(m_early_dmi_ok);
+}
+
+/* Save the compressed blob content, overwrite a header or chunk table field
+ * and try to load it back */
+template <typename T>
+static bool load_patched_image(uint64_t field_offset, T value)
+{
+    std::vector<uint8_t> content = compressed_blob_content();
+    std::vector<uint8_t> out(content.size());
+    std::string fn = boost::filesystem::unique_path().string();
+    uint64_t loaded;
+    bool ret;
+
+    CompressedImage::save(fn, &content[0], content.size(), 4096);
+
+    std::fstream f(fn.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(field_offset);
+    f.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    f.close();
+
+    ret = CompressedImage::load(fn, &out[0], out.size(), false, loaded);
+    std::remove(fn.c_str());
+
+    return ret;
+}
+
+RABBITS_UNIT_TESTBENCH(compressed_blob_corrupt, MemoryTester<>)
+{
+    /* Header: chunk count at 24. Table at 32, 16 bytes per entry: offset,
+     * length, type. Chunk 1 is deflated, chunk 2 raw. */
+    const uint64_t CHUNK_COUNT = 24;
+    const uint64_t DEFLATE_OFFSET = 32 + 16;
+    const uint64_t DEFLATE_LENGTH = 32 + 16 + 8;
+    const uint64_t RAW_LENGTH = 32 + 2 * 16 + 8;
+
+    RABBITS_TEST_ASSERT(!load_patched_image<uint64_t>(CHUNK_COUNT, 1));
+    RABBITS_TEST_ASSERT(!load_patched_image<uint64_t>(CHUNK_COUNT, 1ull << 60));
+    RABBITS_TEST_ASSERT(!load_patched_image<uint32_t>(RAW_LENGTH, 16));
+    RABBITS_TEST_ASSERT(!load_patched_image<uint32_t>(DEFLATE_LENGTH, 0));
+    RABBITS_TEST_ASSERT(!load_patched_image<uint64_t>(DEFLATE_OFFSET, 1ull << 40));
+
+    /* Untouched field, for reference */
+    RABBITS_TEST_ASSERT(load_patched_image<uint64_t>(CHUNK_COUNT, 3));
+}
+
+const uint64_t BENCH_MEM_SIZE = 512ull << 20;
+const uint64_t BENCH_ACCESSES = 1ull << 24;
+
+RABBITS_UNIT_TESTBENCH(bench_random_access, MemoryTester<false COMMA false COMMA BENCH_MEM_SIZE>)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+
+    MLOG(APP, INF) << "random DMI access, regular pages: "
+        << dmi_random_access_bench(dmi, BENCH_ACCESSES) << " ns/access\n";
+}
+
+RABBITS_UNIT_TESTBENCH(bench_random_access_huge_pages,
+                       MemoryTester<false COMMA false COMMA BENCH_MEM_SIZE COMMA TEST_STORAGE_HEAP COMMA true>)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+
+    /* Transparent huge pages require a 2M aligned buffer */
+    RABBITS_TEST_ASSERT_EQ(reinterpret_cast<uintptr_t>(dmi.ptr) & ((2 << 20) - 1), 0);
+
+    MLOG(APP, INF) << "random DMI access, huge pages: "
+        << dmi_random_access_bench(dmi, BENCH_ACCESSES) << " ns/access\n";
+}
+
+#define BENCH_STR_(x) #x
+#define BENCH_STR(x) BENCH_STR_(x)
+
+const uint64_t BENCH_BUS_ACCESSES = 1ull << 18;
+
+/* Zero latencies, accesses do not yield to the SystemC kernel */
+class BenchBusAccessTester : public MemoryTester<> {
+public:
+    BenchBusAccessTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<>(n, c, "read-latency: 0 ns\n"
+                               "write-latency: 0 ns\n")
+    {}
+};
+
+/* Mean cost of a bus access through the memory callbacks, per-access logs
+ * included. Compare builds configured with different
+ * RABBITS_HOTPATH_LOG_LEVEL values to measure the logging overhead. */
+RABBITS_UNIT_TESTBENCH(bench_bus_access, BenchBusAccessTester)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < BENCH_BUS_ACCESSES; i++) {
+        tst.bus_write_u32((i * 4) % MEM_SIZE, i);
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+
+    RABBITS_TEST_ASSERT(tst.bus_read_u32(0) == BENCH_BUS_ACCESSES - MEM_SIZE / 4);
+
+    MLOG(APP, INF) << "bus access, hot path log level "
+        << BENCH_STR(RABBITS_HOTPATH_LOG_LEVEL) << ": "
+        << std::chrono::duration<double, std::nano>(stop - start).count() / BENCH_BUS_ACCESSES
+        << " ns/access\n";
+}
+
+/* Overwrite a field of a snapshot header */
+template <typename T>
+static void patch_snapshot(const std::string &fn, uint64_t field_offset, T value)
+{
+    std::fstream f(fn.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(field_offset);
+    f.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+RABBITS_UNIT_TESTBENCH(snapshot, MemoryTester<>)
+{
+    Memory *m = dynamic_cast<Memory*>(mem);
+    std::string fn = boost::filesystem::unique_path().string();
+
+    RABBITS_TEST_ASSERT(m != NULL);
+
+    tst.debug_write_u32_nofail(0x0, 0xdecacafe);
+    tst.debug_write_u32_nofail(MEM_SIZE - 4, 0xf00df00d);
+
+    RABBITS_TEST_ASSERT(m->save_snapshot(fn));
+
+    tst.debug_write_u32_nofail(0x0, 0);
+    tst.debug_write_u32_nofail(MEM_SIZE - 4, 0);
+
+    RABBITS_TEST_ASSERT(m->restore_snapshot(fn));
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x0), 0xdecacafe);
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(MEM_SIZE - 4), 0xf00df00d);
+
+    /* Corrupt the content, the checksum must not match anymore */
+    FILE *f = std::fopen(fn.c_str(), "r+");
+    std::fseek(f, -1, SEEK_END);
+    std::fputc(0x42, f);
+    std::fclose(f);
+
+    mute_logger();
+    RABBITS_TEST_ASSERT(!m->restore_snapshot(fn));
+    unmute_logger();
+
+    /* Header: data offset at 12. Inside the header, then past the end of
+     * the file. */
+    const uint64_t DATA_OFFSET = 12;
+
+    RABBITS_TEST_ASSERT(m->save_snapshot(fn));
+    patch_snapshot<uint32_t>(fn, DATA_OFFSET, 8);
+    mute_logger();
+    RABBITS_TEST_ASSERT(!m->restore_snapshot(fn));
+    unmute_logger();
+
+    RABBITS_TEST_ASSERT(m->save_snapshot(fn));
+    patch_snapshot<uint32_t>(fn, DATA_OFFSET, 8192);
+    mute_logger();
+    RABBITS_TEST_ASSERT(!m->restore_snapshot(fn));
+    unmute_logger();
+
+    std::remove(fn.c_str());
+}
+
+class CompressedSnapshotTester : public MemoryTester<false, false, 0x100000> {
+protected:
+    CompressedSnapshotTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<false, false, 0x100000>(n, c, "snapshot-compression: true\n") {}
+};
+
+RABBITS_UNIT_TESTBENCH(snapshot_compressed, CompressedSnapshotTester)
+{
+    Memory *m = dynamic_cast<Memory*>(mem);
+    std::string fn = boost::filesystem::unique_path().string();
+
+    RABBITS_TEST_ASSERT(m != NULL);
+
+    tst.debug_write_u32_nofail(0x0, 0xdecacafe);
+    tst.debug_write_u32_nofail(MEM_SIZE - 4, 0xf00df00d);
+
+    RABBITS_TEST_ASSERT(m->save_snapshot(fn));
+    RABBITS_TEST_ASSERT(CompressedImage::is_compressed(fn));
+
+    /* Mostly zeros, which take no space */
+    RABBITS_TEST_ASSERT(boost::filesystem::file_size(fn) < MEM_SIZE / 16);
+
+    tst.debug_write_u32_nofail(0x0, 0);
+    tst.debug_write_u32_nofail(0x8000, 0x12345678);
+    tst.debug_write_u32_nofail(MEM_SIZE - 4, 0);
+
+    /* Zero chunks are restored as well */
+    RABBITS_TEST_ASSERT(m->restore_snapshot(fn));
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x0), 0xdecacafe);
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x8000), 0);
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(MEM_SIZE - 4), 0xf00df00d);
+
+    std::remove(fn.c_str());
+}
+
+/* Memory cloned copy-on-write from a snapshot of a blob-loaded memory */
+class SnapshotCloneTester : public MemoryTester<false, true> {
+protected:
+    ComponentBase *clone;
+    SlaveTester<> clone_tst;
+    std::string m_snapshot_path;
+
+    SnapshotCloneTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<false, true>(n, c), clone_tst("clone-tester", c)
+    {
+        std::stringstream yml;
+
+        m_snapshot_path = boost::filesystem::unique_path().string();
+        dynamic_cast<Memory*>(mem)->save_snapshot(m_snapshot_path);
+
+        yml << "size: " << MEM_SIZE << "\n";
+        yml << "storage: snapshot-private\n";
+        yml << "snapshot-restore: " << m_snapshot_path << "\n";
+
+        clone = create_component_by_implem("generic-memory", yml.str());
+        clone->get_port("mem").connect(clone_tst.get_port("mem"));
+    }
+
+public:
+    ~SnapshotCloneTester() {
+        delete clone;
+        clone = NULL;
+        std::remove(m_snapshot_path.c_str());
+    }
+};
+
+RABBITS_UNIT_TESTBENCH(snapshot_private, SnapshotCloneTester)
+{
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(clone_tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT_EQ(std::memcmp(&m_blob[0], dmi.ptr, BLOB_SIZE), 0);
+
+    clone_tst.bus_write_u32(0x0, 0xf00df00d);
+    RABBITS_TEST_ASSERT(clone_tst.last_access_succeeded());
+    RABBITS_TEST_ASSERT_EQ(clone_tst.bus_read_u32(0x0), 0xf00df00d);
+
+    /* Writes to the clone must not reach the snapshot file: its checksum
+     * still matches */
+    RABBITS_TEST_ASSERT(dynamic_cast<Memory*>(mem)->restore_snapshot(m_snapshot_path));
+}
+
+class DirtyTrackingTester : public MemoryTester<false, false, 0x4000> {
+protected:
+    DirtyTrackingTester(sc_module_name n, ConfigManager &c)
+        : MemoryTester<false, false, 0x4000>(n, c, "dirty-tracking: true\n") {}
+};
+
+RABBITS_UNIT_TESTBENCH(dirty_tracking, DirtyTrackingTester)
+{
+    Memory *m = dynamic_cast<Memory*>(mem);
+    std::string fn = boost::filesystem::unique_path().string();
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(m != NULL);
+    RABBITS_TEST_ASSERT(m->save_snapshot(fn));
+
+    /* Nothing written yet, DMI is read-only */
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT(dmi.read_allowed);
+    RABBITS_TEST_ASSERT(!dmi.write_allowed);
+    RABBITS_TEST_ASSERT_EQ(dmi.range, AddressRange(0, MEM_SIZE));
+
+    tst.bus_write_u32(0x0, 0xdecacafe);
+    RABBITS_TEST_ASSERT(tst.last_access_succeeded());
+
+    /* The written page is now granted write access, on its own */
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT(dmi.is_read_write_allowed());
+    RABBITS_TEST_ASSERT_EQ(dmi.range, AddressRange(0, 0x1000));
+
+    RABBITS_TEST_ASSERT(m->save_incremental_snapshot(fn + ".1"));
+
+    /* Back to clean after an incremental snapshot */
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT(!dmi.write_allowed);
+    RABBITS_TEST_ASSERT_EQ(dmi.range, AddressRange(0, MEM_SIZE));
+
+    tst.debug_write_u32_nofail(0x0, 0);
+
+    RABBITS_TEST_ASSERT(m->restore_snapshot(fn));
+    RABBITS_TEST_ASSERT(m->restore_incremental_snapshot(fn + ".1"));
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x0), 0xdecacafe);
+
+    std::remove(fn.c_str());
+    std::remove((fn + ".1").c_str());
+}
+
+RABBITS_UNIT_TESTBENCH(dirty_tracking_restore, DirtyTrackingTester)
+{
+    Memory *m = dynamic_cast<Memory*>(mem);
+    std::string base = boost::filesystem::unique_path().string();
+    std::string fn = boost::filesystem::unique_path().string();
+    DmiInfo dmi;
+
+    RABBITS_TEST_ASSERT(m != NULL);
+    RABBITS_TEST_ASSERT(m->save_snapshot(base));
+
+    tst.bus_write_u32(0x0, 0xdecacafe);
+    RABBITS_TEST_ASSERT(m->save_snapshot(fn));
+    tst.bus_write_u32(0x1000, 0xf00df00d);
+
+    /* Back to the zeroed base at runtime. Every page now differs from the
+     * last saved snapshot. */
+    RABBITS_TEST_ASSERT(m->restore_snapshot(base));
+
+    RABBITS_TEST_ASSERT(tst.get_dmi_info(dmi));
+    RABBITS_TEST_ASSERT(dmi.is_read_write_allowed());
+    RABBITS_TEST_ASSERT_EQ(dmi.range, AddressRange(0, MEM_SIZE));
+
+    RABBITS_TEST_ASSERT(m->save_incremental_snapshot(fn + ".1"));
+
+    /* Replaying the last snapshot and the increment gives the current
+     * content back */
+    tst.debug_write_u32_nofail(0x0, 0x12345678);
+    RABBITS_TEST_ASSERT(m->restore_snapshot(fn));
+    RABBITS_TEST_ASSERT(m->restore_incremental_snapshot(fn + ".1"));
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x0), 0);
+    RABBITS_TEST_ASSERT_EQ(tst.debug_read_u32_nofail(0x1000), 0);
+
+    std::remove(base.c_str());
+    std::remove(fn.c_str());
+    std::remove((fn + ".1").c_str());
+}
+
+class DramTester : public TestBench {
+protected:
+    ComponentBase *dram;
+    SlaveTester<> tst;
+
+public:
+    DramTester(sc_module_name n, ConfigManager &c, const std::string &extra_yml = "")
+        : TestBench(n, c), tst("slave-tester", c)
+    {
+        std::string yml = "size: 0x10000\n"
+                          "banks: 4\n"
+                          "row-size: 1024\n"
+                          "trcd: 10 ns\n"
+                          "tcas: 20 ns\n"
+                          "trp: 40 ns\n";
+
+        dram = create_component_by_implem("dram", yml + extra_yml);
+
+        dram->get_port("mem").connect(tst.get_port("mem"));
+    }
+
+    ~DramTester() {
+        delete dram;
+        dram = NULL;
+    }
+};
+
+RABBITS_UNIT_TESTBENCH(dram_row_buffer, DramTester)
+{
+    DmiInfo dmi;
+
+    /* Exact timings by default, no DMI */
+    RABBITS_TEST_ASSERT(!tst.get_dmi_info(dmi));
+
+    /* Bank 0 precharged */
+    tst.bus_read_u32(0x0);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(10 + 20, SC_NS));
+
+    /* Row hit */
+    tst.bus_read_u32(0x4);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(20, SC_NS));
+
+    /* Next row is in bank 1, precharged */
+    tst.bus_read_u32(0x400);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(10 + 20, SC_NS));
+
+    /* Another row of bank 0 */
+    tst.bus_read_u32(4 * 0x400);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(40 + 10 + 20, SC_NS));
+
+    Dram *d = dynamic_cast<Dram*>(dram);
+    RABBITS_TEST_ASSERT(d != NULL);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(0).hits, 1);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(0).misses, 1);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(0).conflicts, 1);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(1).misses, 1);
+}
+
+class ClosedPageDramTester : public DramTester {
+public:
+    ClosedPageDramTester(sc_module_name n, ConfigManager &c)
+        : DramTester(n, c, "page-policy: closed\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(dram_closed_page, ClosedPageDramTester)
+{
+    /* Activation, column access then precharge, whatever the row */
+    tst.bus_read_u32(0x0);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(10 + 20 + 40, SC_NS));
+
+    tst.bus_read_u32(0x4);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(10 + 20 + 40, SC_NS));
+
+    tst.bus_read_u32(4 * 0x400);
+    RABBITS_TEST_ASSERT_TIME_DELTA(sc_time(10 + 20 + 40, SC_NS));
+
+    Dram *d = dynamic_cast<Dram*>(dram);
+    RABBITS_TEST_ASSERT(d != NULL);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(0).hits, 0);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(0).misses, 3);
+    RABBITS_TEST_ASSERT_EQ(d->get_bank_stats(0).conflicts, 0);
+}
+
+class DecoupledDramTester : public DramTester {
+public:
+    DecoupledDramTester(sc_module_name n, ConfigManager &c)
+        : DramTester(n, c, "temporal-decoupling: true\n"
+                           "global-quantum: 1 us\n")
+    {}
+};
+
+RABBITS_UNIT_TESTBENCH(dram_temporal_decoupling, DecoupledDramTester)
+{
+    uint32_t data = 0;
+    sc_time start = sc_time_stamp();
+    sc_time delay;
+
+    /* Bank 0 precharged, then a row hit, both annotated */
+    delay = b_access(tst, tlm::TLM_READ_COMMAND, 0x0, data);
+    RABBITS_TEST_ASSERT_EQ(delay, sc_time(10 + 20, SC_NS));
+
+    delay = b_access(tst, tlm::TLM_READ_COMMAND, 0x4, data, delay);
+    RABBITS_TEST_ASSERT_EQ(delay, sc_time(10 + 20 + 20, SC_NS));
+    RABBITS_TEST_ASSERT_EQ(sc_time_stamp(), start);
+}
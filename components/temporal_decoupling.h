@@ -0,0 +1,75 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _TEMPORAL_DECOUPLING_H_
+#define _TEMPORAL_DECOUPLING_H_
+
+#include <systemc>
+#include <tlm>
+
+/*
+ * Latency accounting shared by the components supporting temporal
+ * decoupling. When decoupled, latencies are annotated on the transaction
+ * delay and the initiator is only synchronized once its local time goes past
+ * the TLM global quantum. Otherwise, the latency is waited for right away.
+ */
+
+/* Set the TLM global quantum, unless `quantum' is zero. The global quantum is
+ * shared by the whole platform: if another component already set it to a
+ * different value, that value is kept and `conflict' is set. Returns false if
+ * the resulting global quantum is zero, in which case decoupling degenerates
+ * into a synchronization on every access. */
+static inline bool setup_global_quantum(const sc_core::sc_time &quantum,
+                                        bool &conflict)
+{
+    tlm::tlm_global_quantum &gq = tlm::tlm_global_quantum::instance();
+
+    conflict = false;
+
+    if (quantum != sc_core::SC_ZERO_TIME) {
+        if (gq.get() == sc_core::SC_ZERO_TIME) {
+            gq.set(quantum);
+        } else if (gq.get() != quantum) {
+            conflict = true;
+        }
+    }
+
+    return gq.get() != sc_core::SC_ZERO_TIME;
+}
+
+static inline void apply_latency(bool decoupled, const sc_core::sc_time &lat,
+                                 sc_core::sc_time &delay)
+{
+    if (!decoupled) {
+        if (lat != sc_core::SC_ZERO_TIME) {
+            sc_core::wait(lat);
+        }
+        return;
+    }
+
+    delay += lat;
+
+    if (delay != sc_core::SC_ZERO_TIME
+        && delay >= tlm::tlm_global_quantum::instance().compute_local_quantum()) {
+        sc_core::wait(delay);
+        delay = sc_core::SC_ZERO_TIME;
+    }
+}
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ *  This file is part of Rabbits
+ *  Copyright (C) 2017  Clement Deschamps and Luc Michel
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Decode a binary memory access trace, as recorded by the `trace-file'
+ * parameter of the memory and stub components, into text. One line per
+ * access: time in ns, direction, address, size and data when recorded.
+ *
+ * With -s, print a summary instead: read/write mix and an address
+ * histogram with -g bytes wide buckets. For every-nth and random sampled
+ * traces, estimated totals are scaled by the sampling rate.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <map>
+
+#include <unistd.h>
+
+#include "access_trace.h"
+
+static void usage(const char *prog)
+{
+    std::fprintf(stderr, "Usage: %s [-s [-g granularity]] <trace-file>\n", prog);
+}
+
+struct Counts {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+
+    Counts() : reads(0), writes(0), read_bytes(0), write_bytes(0) {}
+
+    void add(const AccessTraceRecord &r)
+    {
+        if (r.flags & AccessTraceRecord::WRITE) {
+            writes++;
+            write_bytes += r.size;
+        } else {
+            reads++;
+            read_bytes += r.size;
+        }
+    }
+};
+
+static const char * sampling_name(uint32_t s)
+{
+    switch (s) {
+    case ACCESS_TRACE_SAMPLE_EVERY_NTH:
+        return "every-nth";
+    case ACCESS_TRACE_SAMPLE_RANDOM:
+        return "random";
+    case ACCESS_TRACE_SAMPLE_WINDOW:
+        return "window";
+    case ACCESS_TRACE_SAMPLE_ALL:
+    default:
+        return "all";
+    }
+}
+
+static void print_record(const AccessTraceRecord &r, double ns_per_unit)
+{
+    std::printf("%16.3f %c 0x%016" PRIx64 " %3" PRIu32,
+                r.time * ns_per_unit,
+                (r.flags & AccessTraceRecord::WRITE) ? 'W' : 'R',
+                r.addr, r.size);
+
+    if (r.flags & AccessTraceRecord::HAS_DATA) {
+        uint32_t len = r.size < sizeof(r.data) ? r.size : sizeof(r.data);
+
+        std::printf(" ");
+
+        for (uint32_t i = 0; i < len; i++) {
+            std::printf("%02x", r.data[i]);
+        }
+    }
+
+    std::printf("\n");
+}
+
+static void print_summary(const AccessTraceReader &trace, const Counts &total,
+                          const std::map<uint64_t, Counts> &histogram,
+                          uint64_t granularity)
+{
+    const AccessTraceHeader &hdr = trace.get_header();
+    uint64_t n = total.reads + total.writes;
+    uint64_t scale = trace.get_scale();
+
+    std::printf("sampling: %s", sampling_name(hdr.sampling));
+
+    if (scale != 1) {
+        std::printf(", 1 in %" PRIu64, scale);
+    }
+
+    std::printf("\nrecords: %" PRIu64 " (estimated accesses: %" PRIu64 ")\n", n, n * scale);
+
+    if (n == 0) {
+        return;
+    }
+
+    std::printf("reads: %" PRIu64 " (%.1f%%), %" PRIu64 " bytes\n",
+                total.reads, 100.0 * total.reads / n, total.read_bytes);
+    std::printf("writes: %" PRIu64 " (%.1f%%), %" PRIu64 " bytes\n",
+                total.writes, 100.0 * total.writes / n, total.write_bytes);
+
+    std::printf("\n%18s %18s %12s %12s %7s\n", "start", "end", "reads", "writes", "share");
+
+    for (const auto &b: histogram) {
+        const Counts &c = b.second;
+
+        std::printf("0x%016" PRIx64 " 0x%016" PRIx64 " %12" PRIu64 " %12" PRIu64 " %6.2f%%\n",
+                    b.first, b.first + granularity - 1, c.reads, c.writes,
+                    100.0 * (c.reads + c.writes) / n);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    AccessTraceReader trace;
+    AccessTraceRecord r;
+    bool summary = false;
+    uint64_t granularity = 4096;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "sg:")) != -1) {
+        switch (opt) {
+        case 's':
+            summary = true;
+            break;
+
+        case 'g':
+            granularity = std::strtoull(optarg, NULL, 0);
+            break;
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1 || granularity == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *fn = argv[optind];
+
+    switch (trace.open(fn)) {
+    case AccessTraceReader::OK:
+        break;
+
+    case AccessTraceReader::CANNOT_OPEN:
+        std::fprintf(stderr, "Cannot open %s\n", fn);
+        return 1;
+
+    case AccessTraceReader::BAD_MAGIC:
+        std::fprintf(stderr, "%s is not an access trace\n", fn);
+        return 1;
+
+    case AccessTraceReader::BAD_VERSION:
+        std::fprintf(stderr, "Unsupported trace version %" PRIu32 "\n",
+                     trace.get_header().version);
+        return 1;
+    }
+
+    double ns_per_unit = trace.get_header().time_resolution_fs / 1e6;
+    Counts total;
+    std::map<uint64_t, Counts> histogram;
+
+    while (trace.read(r)) {
+        if (!summary) {
+            print_record(r, ns_per_unit);
+            continue;
+        }
+
+        total.add(r);
+        histogram[r.addr - r.addr % granularity].add(r);
+    }
+
+    trace.close();
+
+    if (summary) {
+        print_summary(trace, total, histogram, granularity);
+    }
+
+    return 0;
+}